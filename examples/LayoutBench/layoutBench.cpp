@@ -0,0 +1,244 @@
+#include <libstate.hpp>
+
+#include <chrono>
+#include <cstring>
+#include <random>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Сравнение раскладки таблицы переходов: std::map, скомпилированная
+// таблица без профиля и с профилем. Граф большой (кэш имеет значение),
+// но почти весь трафик идет по короткому горячему циклу.
+namespace
+{
+    constexpr std::size_t kStates = 512;
+    constexpr std::size_t kEvents = 16;
+    constexpr std::size_t kHotStates = 32;
+    constexpr std::size_t kSteps = 1 << 20;
+    constexpr double kHotShare = 0.95;
+
+    enum class Signal : short
+    {
+    };
+
+    using BenchState = SM::State<Signal>;
+    using BenchEvent = SM::Events::Base<Signal>;
+
+    // Состояние переходит по событию из параметра "e"
+    class Step : public BenchState
+    {
+      public:
+        Step(const std::string &name)
+            : BenchState(name, {"e"})
+        {
+        }
+
+        BenchEvent update(const SM::outsideParams &params) override
+        {
+            const std::string *event = param(0);
+            if (!event)
+                return BenchEvent{SM::Events::Type::None, this};
+            return SM::Events::Switch<Signal>{this,
+                                              Signal(std::stoi(*event))};
+        }
+    };
+
+    // Описание графа: target[state][event], горячий цикл и горячее
+    // событие каждого состояния
+    struct Graph
+    {
+        std::vector<std::array<std::size_t, kEvents>> m_target;
+        std::vector<std::size_t> m_hot_event;
+        std::vector<std::string> m_names;
+
+        Graph()
+            : m_target(kStates)
+            , m_hot_event(kStates)
+            , m_names(kStates)
+        {
+            std::mt19937 rng(1);
+            for (std::size_t i = 0; i < kStates; ++i)
+            {
+                // Имена случайные: порядок по имени не совпадает с
+                // горячим путем
+                m_names[i] = "S" + std::to_string(rng()) + "_" +
+                             std::to_string(i);
+                m_hot_event[i] = rng() % kEvents;
+                for (auto &target : m_target[i])
+                    target = rng() % kStates;
+            }
+            for (std::size_t i = 0; i < kHotStates; ++i)
+                m_target[i][m_hot_event[i]] = (i + 1) % kHotStates;
+        }
+    };
+
+    class Bench : public SM::Scenario<Signal>
+    {
+      public:
+        Bench(const Graph &graph)
+            : m_graph(graph)
+        {
+        }
+
+        BenchEvent init(const SM::outsideParams &params) override
+        {
+            std::vector<Step *> states;
+            for (const auto &name : m_graph.m_names)
+                states.push_back(addState<Step>(name));
+            for (std::size_t i = 0; i < kStates; ++i)
+                for (std::size_t e = 0; e < kEvents; ++e)
+                    addTransfer(states[i], states[m_graph.m_target[i][e]],
+                                Signal(e));
+            setStartState(states[0]);
+            return BenchEvent(SM::Events::Type::None);
+        }
+
+      private:
+        const Graph &m_graph;
+    };
+
+    // Аппаратный счетчик; если perf недоступен, значения не выводятся
+    class Counter
+    {
+      public:
+        Counter(std::uint32_t type, std::uint64_t config)
+        {
+#ifdef __linux__
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = type;
+            attr.config = config;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            m_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+        }
+
+        ~Counter()
+        {
+#ifdef __linux__
+            if (m_fd >= 0)
+                close(m_fd);
+#endif
+        }
+
+        void start()
+        {
+#ifdef __linux__
+            if (m_fd < 0)
+                return;
+            ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+        }
+
+        /// @return Значение счетчика или -1, если он недоступен
+        long long stop()
+        {
+            long long value = -1;
+#ifdef __linux__
+            if (m_fd < 0)
+                return -1;
+            ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(m_fd, &value, sizeof(value)) != sizeof(value))
+                value = -1;
+#endif
+            return value;
+        }
+
+      private:
+        int m_fd = -1;
+    };
+
+    std::string perStep(long long value)
+    {
+        return value < 0 ? "n/a" : std::to_string(double(value) / kSteps);
+    }
+
+    void run(const std::string &name, Bench &bench,
+             const std::vector<SM::outsideParams> &inputs,
+             const std::vector<std::size_t> &sequence)
+    {
+#ifdef __linux__
+        Counter cache_misses(PERF_TYPE_HARDWARE,
+                             PERF_COUNT_HW_CACHE_MISSES);
+        Counter l1d_misses(PERF_TYPE_HW_CACHE,
+                           PERF_COUNT_HW_CACHE_L1D |
+                               (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                               (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+#else
+        Counter cache_misses(0, 0), l1d_misses(0, 0);
+#endif
+        cache_misses.start();
+        l1d_misses.start();
+        auto begin = std::chrono::steady_clock::now();
+        for (auto input : sequence)
+            bench.update(inputs[input]);
+        auto end = std::chrono::steady_clock::now();
+        auto l1d = l1d_misses.stop();
+        auto llc = cache_misses.stop();
+
+        std::cerr << name << ": "
+                  << std::chrono::duration<double, std::nano>(end - begin)
+                             .count() /
+                         kSteps
+                  << " ns/update, cache-misses/update=" << perStep(llc)
+                  << ", L1d-misses/update=" << perStep(l1d)
+                  << ", final state="
+                  << bench.getCurrentState()->getName() << "\n";
+    }
+} // namespace
+
+int main()
+{
+    SM::Log::setSink(nullptr);
+
+    Graph graph;
+    std::vector<SM::outsideParams> inputs;
+    for (std::size_t e = 0; e < kEvents; ++e)
+        inputs.push_back({{"e", std::to_string(e)}});
+
+    // Последовательность событий: в основном горячее событие
+    // текущего состояния
+    std::vector<std::size_t> sequence(kSteps);
+    std::mt19937 rng(2);
+    std::bernoulli_distribution hot(kHotShare);
+    std::size_t cur = 0;
+    for (auto &event : sequence)
+    {
+        event = hot(rng) ? graph.m_hot_event[cur] : rng() % kEvents;
+        cur = graph.m_target[cur][event];
+    }
+
+    Bench by_map(graph);
+    by_map.init({});
+    run("std::map       ", by_map, inputs, sequence);
+
+    Bench frozen(graph);
+    frozen.init({});
+    frozen.freeze();
+    run("frozen         ", frozen, inputs, sequence);
+
+    // Профиль собирается в отдельном прогоне, чтобы замеры frozen и
+    // frozen+profile шли в одинаковых условиях (без счета переходов)
+    Bench warm_up(graph);
+    warm_up.init({});
+    warm_up.freeze();
+    warm_up.setProfiling(true);
+    for (auto input : sequence)
+        warm_up.update(inputs[input]);
+    auto profile = warm_up.exportProfile();
+
+    Bench guided(graph);
+    guided.init({});
+    guided.freeze(&profile);
+    run("frozen+profile ", guided, inputs, sequence);
+    return 0;
+}
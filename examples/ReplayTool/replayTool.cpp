@@ -0,0 +1,90 @@
+#include "updatePassword.hpp"
+
+#include <trace.hpp>
+
+#include <random>
+
+namespace
+{
+    void usage()
+    {
+        std::cerr
+            << "Usage:\n"
+            << "  ReplayTool record <file> [sessions] [messages]\n"
+            << "      записать синтетическую трассу UpdatePassword\n"
+            << "  ReplayTool replay <file> [threads] [paced]\n"
+            << "      воспроизвести трассу через UpdatePassword\n";
+    }
+
+    // Синтетический поток: пользователи присылают пустые сообщения и
+    // пароли вперемешку
+    int record(const std::string &path, std::size_t sessions,
+               std::size_t messages)
+    {
+        if (!sessions)
+        {
+            std::cerr << "sessions must be positive\n";
+            return 1;
+        }
+        SM::Trace::Recorder recorder(path);
+        if (!recorder.isOpen())
+        {
+            std::cerr << "cannot open trace file: " << path << "\n";
+            return 1;
+        }
+        std::vector<std::unique_ptr<UpdatePassword>> scenarios;
+        for (std::size_t i = 0; i < sessions; ++i)
+        {
+            scenarios.push_back(std::make_unique<UpdatePassword>());
+            scenarios.back()->init({});
+            scenarios.back()->setRecorder(&recorder, i);
+        }
+
+        const SM::outsideParams inputs[] = {
+            {}, {{"password", "123"}}, {{"password", "456"}},
+            {{"password", "new-password"}}};
+        std::mt19937_64 rng(42);
+        for (std::size_t i = 0; i < messages; ++i)
+        {
+            auto &scenario = scenarios[rng() % sessions];
+            scenario->update(inputs[rng() % std::size(inputs)]);
+        }
+        recorder.flush();
+        std::cerr << "recorded " << recorder.count() << " messages\n";
+        return 0;
+    }
+
+    int replay(const std::string &path, std::size_t threads, bool paced)
+    {
+        std::vector<SM::Trace::Record> records;
+        if (!SM::Trace::load(path, records))
+            return 1;
+
+        SM::Trace::Replayer<UpdatePassword> replayer(
+            [] { return std::make_unique<UpdatePassword>(); });
+        auto report = replayer.run(records, {threads, paced});
+        report.print(std::cerr);
+        return 0;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        usage();
+        return 1;
+    }
+    SM::Log::setSink(nullptr);
+
+    std::string mode = argv[1];
+    std::string path = argv[2];
+    if (mode == "record")
+        return record(path, argc > 3 ? std::stoul(argv[3]) : 1000,
+                      argc > 4 ? std::stoul(argv[4]) : 100000);
+    if (mode == "replay")
+        return replay(path, argc > 3 ? std::stoul(argv[3]) : 1,
+                      argc > 4 && std::string(argv[4]) == "paced");
+    usage();
+    return 1;
+}
@@ -0,0 +1,159 @@
+#include "updatePassword.hpp"
+
+#include <scheduler.hpp>
+
+#include <random>
+
+// Нагрузка: много обычных пользователей изредка присылают пароль, а
+// боты с тысяч сессий долбят CheckPassword неверным паролем и держат
+// очередь необработанных сообщений у своей квоты. Сравниваются
+// задержки update() для пользователей: без ботов, с ботами при базовых
+// настройках и при изменении ровно одной настройки относительно
+// базовых.
+namespace
+{
+    using Scheduler = SM::Scheduler<UpdatePassword>;
+
+    constexpr SM::TenantId kUsers = 0;
+    constexpr SM::TenantId kBots = 1;
+    constexpr std::size_t kUserSessions = 1000;
+    constexpr std::size_t kBotSessions = 2000;
+    // Боты присылают до kBotBurst сообщений раз в kBotInterval (больше,
+    // чем планировщик успевает обработать) и не занимают процессор
+    // между пачками
+    constexpr std::size_t kBotBurst = 256;
+    constexpr auto kBotInterval = std::chrono::microseconds(200);
+    constexpr auto kDuration = std::chrono::seconds(2);
+    constexpr auto kUserInterval = std::chrono::microseconds(200);
+
+    struct Latencies
+    {
+        std::mutex m_mutex;
+        std::vector<std::uint64_t> m_users;
+        std::size_t m_bots = 0;
+    };
+
+    std::uint64_t percentile(std::vector<std::uint64_t> &values, double q)
+    {
+        if (values.empty())
+            return 0;
+        std::sort(values.begin(), values.end());
+        return values[std::min(values.size() - 1,
+                               std::size_t(q * values.size()))];
+    }
+
+    // Один прогон нагрузки
+    struct Config
+    {
+        const char *m_name;
+        Scheduler::Options m_options;
+        bool m_bots = true;
+        // Квота ботов: по умолчанию очередь ботов заметно длиннее
+        // пачки
+        std::size_t m_bot_quota = 4000;
+        double m_user_weight = 1.0;
+    };
+
+    void run(const Config &config)
+    {
+        Latencies latencies;
+        Scheduler scheduler(config.m_options, [&latencies](const auto &done) {
+            std::lock_guard<std::mutex> lock(latencies.m_mutex);
+            if (done.m_tenant == kUsers)
+                latencies.m_users.push_back(done.m_latency_ns);
+            else
+                ++latencies.m_bots;
+        });
+        scheduler.setTenant(kUsers, {config.m_user_weight, 0});
+        scheduler.setTenant(kBots, {1.0, config.m_bot_quota});
+
+        for (SM::SessionId id = 0; id < kUserSessions + kBotSessions; ++id)
+        {
+            auto scenario = std::make_unique<UpdatePassword>();
+            scenario->init({});
+            scheduler.addSession(id, id < kUserSessions ? kUsers : kBots,
+                                 std::move(scenario));
+        }
+        scheduler.start();
+
+        std::atomic<bool> running{true};
+        std::thread bots([&scheduler, &running, &config] {
+            const SM::outsideParams wrong = {{"password", "456"}};
+            std::size_t i = 0;
+            while (running && config.m_bots)
+            {
+                for (std::size_t sent = 0;
+                     sent < kBotBurst &&
+                     scheduler.submit(kUserSessions + i++ % kBotSessions,
+                                      wrong);
+                     ++sent)
+                    ;
+                std::this_thread::sleep_for(kBotInterval);
+            }
+        });
+
+        std::mt19937_64 rng(7);
+        const SM::outsideParams inputs[] = {{}, {{"password", "123"}}};
+        auto finish = Scheduler::Clock::now() + kDuration;
+        auto next = Scheduler::Clock::now();
+        while (Scheduler::Clock::now() < finish)
+        {
+            scheduler.submit(rng() % kUserSessions, inputs[rng() % 2],
+                             std::chrono::milliseconds(5));
+            next += kUserInterval;
+            std::this_thread::sleep_until(next);
+        }
+        running = false;
+        bots.join();
+        scheduler.stop();
+
+        auto stats = scheduler.stats();
+        std::cerr << config.m_name << ":\n"
+                  << "  users: " << latencies.m_users.size()
+                  << " msgs, p50="
+                  << percentile(latencies.m_users, 0.5) / 1000
+                  << "us p99=" << percentile(latencies.m_users, 0.99) / 1000
+                  << "us max=" << percentile(latencies.m_users, 1.0) / 1000
+                  << "us\n"
+                  << "  bots:  " << latencies.m_bots << " msgs, "
+                  << stats.m_rejected << " rejected by quota\n"
+                  << "  stolen: " << stats.m_stolen
+                  << ", overdue: " << stats.m_overdue << "\n";
+    }
+} // namespace
+
+int main()
+{
+    SM::Log::setSink(nullptr);
+
+    std::size_t workers =
+        std::max(2u, std::thread::hardware_concurrency());
+
+    // Базовые настройки: FIFO, по одному сообщению за раз, с кражей
+    // работы, без квоты ботов. Каждый следующий прогон меняет одну
+    // настройку относительно базового прогона с ботами.
+    const Scheduler::Options base{workers, Scheduler::Policy::Fifo, 1, true};
+    auto with = [&base](auto change) {
+        Scheduler::Options options = base;
+        change(options);
+        return options;
+    };
+
+    const Config configs[] = {
+        {"users only (reference)", base, false},
+        {"base: fifo + bots", base},
+        {"batch = drain", with([](auto &o) { o.m_batch = 0; })},
+        {"no work stealing",
+         with([](auto &o) { o.m_work_stealing = false; })},
+        {"bot quota 64", base, true, 64},
+        {"weighted fair, users weight 8",
+         with([](auto &o) { o.m_policy = Scheduler::Policy::WeightedFair; }),
+         true, 4000, 8.0},
+        {"earliest deadline", with([](auto &o) {
+             o.m_policy = Scheduler::Policy::EarliestDeadline;
+         })},
+    };
+    for (const auto &config : configs)
+        run(config);
+    return 0;
+}
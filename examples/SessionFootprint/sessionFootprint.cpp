@@ -0,0 +1,56 @@
+#include "updatePassword.hpp"
+
+#include <sessionpool.hpp>
+
+#include <random>
+
+// Миллион простаивающих сессий UpdatePassword в компактном пуле:
+// часть сессий продвигается по сценарию, часть завершается, после чего
+// выводится отчет о памяти и сравнение с целью kTargetBytes на сессию
+// (запись, слэбы и контексты сценария).
+int main()
+{
+    SM::Log::setSink(nullptr);
+
+    constexpr std::size_t kSessions = 1000000;
+    constexpr double kTargetBytes = 32;
+
+    SM::SessionPool<UpdatePassword> pool;
+    auto definition = pool.addDefinition(std::make_unique<UpdatePassword>());
+
+    std::vector<SM::SessionHandle> sessions;
+    sessions.reserve(kSessions);
+    for (std::size_t i = 0; i < kSessions; ++i)
+        sessions.push_back(pool.create(definition));
+
+    // Каждая третья сессия ввела правильный старый пароль и ждет
+    // новый, каждая пятая закончилась
+    std::mt19937 rng(5);
+    for (std::size_t i = 0; i < kSessions; ++i)
+    {
+        if (i % 3 == 0)
+            pool.update(sessions[i], {{"password", "123"}});
+        if (rng() % 5 == 0)
+            pool.release(sessions[i]);
+    }
+
+    auto &scenario = pool.definition(definition);
+    std::map<std::uint16_t, std::size_t> states;
+    for (auto handle : sessions)
+        if (pool.valid(handle))
+            ++states[pool.stateId(handle)];
+
+    std::cerr << "sizeof(UpdatePassword) without states and maps: "
+              << sizeof(scenario) << " bytes\n";
+    auto report = pool.memoryReport();
+    report.print(std::cerr);
+    std::cerr << "target:            < " << kTargetBytes
+              << " bytes per session, "
+              << (report.m_bytes_per_session < kTargetBytes ? "met"
+                                                            : "missed")
+              << "\n";
+    std::cerr << "sessions per state id:\n";
+    for (const auto &[id, count] : states)
+        std::cerr << "  " << id << ": " << count << "\n";
+    return 0;
+}
@@ -0,0 +1,791 @@
+#include <libstate.hpp>
+#include <scheduler.hpp>
+#include <sessionpool.hpp>
+#include <sessionstore.hpp>
+
+#include <random>
+#include <set>
+
+// Проверки внутренних структур библиотеки: KeySet, Context, цепочки
+// переходов, раскладки таблицы, контексты и перекомпиляция в
+// SessionPool, конечные состояния, удаление сессий в Scheduler и
+// хранилища SessionStore. Программа выводит каждую нарушенную
+// проверку и завершается с ненулевым кодом, если такие есть.
+namespace
+{
+    int g_failures = 0;
+
+    void check(bool condition, const std::string &what)
+    {
+        if (condition)
+            return;
+        ++g_failures;
+        std::cerr << "FAILED: " << what << "\n";
+    }
+
+    // Идеальный хеш KeySet. На 300 ключах в таблице на 1024 ячейки
+    // коллизии неизбежны: build() перебирает сотни затравок и дважды
+    // увеличивает таблицу.
+    void checkKeySet()
+    {
+        SM::KeySet keys;
+        check(keys.find("password") == SM::KeySet::kUndeclared,
+              "empty KeySet finds nothing");
+
+        std::vector<std::string> names;
+        for (int i = 0; i < 300; ++i)
+        {
+            names.push_back("key_" + std::to_string(i));
+            check(keys.add(names.back()) == i, "add assigns dense slots");
+        }
+        check(keys.add("key_17") == 17, "repeated add keeps the slot");
+        check(keys.size() == 300, "repeated add does not grow the set");
+        check(!keys.isBuilt(), "add invalidates the hash");
+        check(keys.find("key_0") == SM::KeySet::kUndeclared,
+              "find before build finds nothing");
+
+        keys.build();
+        check(keys.isBuilt(), "build marks the hash as built");
+        for (int i = 0; i < 300; ++i)
+            check(keys.find(names[i]) == i, "find " + names[i]);
+        for (int i = 300; i < 1300; ++i)
+            check(keys.find("key_" + std::to_string(i)) ==
+                      SM::KeySet::kUndeclared,
+                  "undeclared key_" + std::to_string(i));
+        check(keys.find("") == SM::KeySet::kUndeclared,
+              "empty key is undeclared");
+
+        // Ключ, добавленный после build(), находится после пересборки
+        check(keys.add("late") == 300, "late key gets the next slot");
+        check(keys.find("key_0") == SM::KeySet::kUndeclared,
+              "find after add without build finds nothing");
+        keys.build();
+        check(keys.find("late") == 300, "late key is found");
+        check(keys.find("key_0") == 0, "old keys survive a rebuild");
+    }
+
+    enum class Signal : short
+    {
+        Next,
+    };
+
+    // Состояние объявляет один ключ и читает как объявленный, так и
+    // несуществующий номер ключа
+    class Probe : public SM::State<Signal>
+    {
+      public:
+        Probe()
+            : SM::State<Signal>("Probe", {"password"})
+        {
+        }
+
+        SM::Events::Base<Signal> update(
+            const SM::outsideParams &params) override
+        {
+            // Указатели живут только во время update(), сохраняем копии
+            if (auto *value = param(0))
+                m_declared = *value;
+            m_undeclared = param(1) != nullptr;
+            return SM::Events::Base<Signal>{SM::Events::Type::None, this};
+        }
+
+        std::optional<std::string> m_declared;
+        bool m_undeclared = false;
+    };
+
+    // Состояние добавлено после входа: слота для его ключа во входных
+    // данных сценария еще нет
+    class LateProbe : public SM::State<Signal>
+    {
+      public:
+        LateProbe()
+            : SM::State<Signal>("LateProbe", {"late"})
+        {
+        }
+
+        bool reads() const
+        {
+            return param(0) != nullptr;
+        }
+    };
+
+    class ProbeScenario : public SM::Scenario<Signal>
+    {
+      public:
+        SM::Events::Base<Signal> init(const SM::outsideParams &) override
+        {
+            m_probe = addState<Probe>();
+            setStartState(m_probe);
+            return SM::Events::Base<Signal>(SM::Events::Type::None);
+        }
+
+        LateProbe *addLate()
+        {
+            return addState<LateProbe>();
+        }
+
+        Probe *m_probe = nullptr;
+    };
+
+    void checkParam()
+    {
+        ProbeScenario scenario;
+        scenario.init({});
+        scenario.update({{"password", "123"}, {"other", "x"}});
+        auto *probe = scenario.m_probe;
+        check(probe->m_declared == "123",
+              "declared key is read from its slot");
+        check(!probe->m_undeclared,
+              "undeclared key number gives nullptr");
+        check(scenario.undeclaredKeys() == 1,
+              "undeclared input key is counted");
+        check(!scenario.addLate()->reads(),
+              "key declared after the last input gives nullptr");
+    }
+
+    // Содержимое версии Context в виде std::map для сравнения
+    std::map<std::string, std::string> contents(const SM::Context &context)
+    {
+        std::map<std::string, std::string> result;
+        std::string previous;
+        bool ordered = true;
+        context.forEach([&](const std::string &key,
+                            const std::string &value) {
+            ordered = ordered && (result.empty() || previous < key);
+            previous = key;
+            result.emplace(key, value);
+        });
+        check(ordered, "forEach visits keys in ascending order");
+        check(result.size() == context.size(), "size matches contents");
+        return result;
+    }
+
+    // Context сравнивается с std::map на случайных set/erase (в том
+    // числе удаление внутренних узлов). Часть версий сохраняется и
+    // проверяется в конце: последующие изменения не должны их менять.
+    void checkContext()
+    {
+        SM::Context empty;
+        check(empty.empty() && !empty.get("a"), "empty context");
+        check(empty.erase("a").sameVersion(empty),
+              "erase of a missing key keeps the version");
+
+        std::mt19937 rng(3);
+        SM::Context context;
+        std::map<std::string, std::string> model;
+        std::vector<std::pair<SM::Context,
+                              std::map<std::string, std::string>>>
+            snapshots;
+        for (int step = 0; step < 5000; ++step)
+        {
+            std::string key = "k" + std::to_string(rng() % 200);
+            if (rng() % 3)
+            {
+                std::string value = std::to_string(step);
+                SM::Context next = context.set(key, value);
+                check(!next.sameVersion(context),
+                      "set makes a new version");
+                context = next;
+                model[key] = value;
+            }
+            else
+            {
+                context = context.erase(key);
+                model.erase(key);
+            }
+
+            const std::string *found = context.get(key);
+            auto it = model.find(key);
+            check(it == model.end() ? !found
+                                    : found && *found == it->second,
+                  "get after step " + std::to_string(step));
+            if (step % 500 == 0)
+                snapshots.emplace_back(context, model);
+        }
+        check(contents(context) == model, "final contents match std::map");
+        for (const auto &[snapshot, expected] : snapshots)
+            check(contents(snapshot) == expected,
+                  "old version is not changed by later set/erase");
+
+        // Удаление всех ключей по одному, начиная с середины
+        std::vector<std::string> keys;
+        for (const auto &[key, value] : model)
+            keys.push_back(key);
+        std::rotate(keys.begin(), keys.begin() + keys.size() / 2,
+                    keys.end());
+        SM::Context full = context;
+        for (const auto &key : keys)
+            context = context.erase(key);
+        check(context.empty(), "erasing every key empties the context");
+        check(contents(full) == model,
+              "erasing does not touch the source");
+    }
+
+    // Состояние считает свои запуски в контексте и переходит само в
+    // себя, пока счетчик не дойдет до 3. Данные события пустые, поэтому
+    // цепочку отличает от цикла только контекст.
+    class Counter : public SM::State<Signal>
+    {
+      public:
+        Counter()
+            : SM::State<Signal>("Counter")
+        {
+        }
+
+        SM::Events::Base<Signal> update(
+            const SM::outsideParams &params) override
+        {
+            const std::string *count = context().get("count");
+            int next = count ? std::stoi(*count) + 1 : 1;
+            if (next == 3)
+                return SM::Events::Request{this, Signal::Next,
+                                           context().set("count", "3")};
+            return SM::Events::Switch{this, Signal::Next,
+                                      context().set("count",
+                                                    std::to_string(next))};
+        }
+    };
+
+    class CounterScenario : public SM::Scenario<Signal>
+    {
+      public:
+        SM::Events::Base<Signal> init(const SM::outsideParams &) override
+        {
+            auto *counter = addState<Counter>();
+            addTransfer(counter, counter, Signal::Next);
+            setStartState(counter);
+            return SM::Events::Base<Signal>(SM::Events::Type::None);
+        }
+    };
+
+    void checkContextChain()
+    {
+        CounterScenario scenario;
+        scenario.init({});
+        auto event = scenario.update({});
+        const std::string *count = scenario.getContext().get("count");
+        check(event.m_type == SM::Events::Type::Request,
+              "chain through one state ends with Request");
+        check(count && *count == "3",
+              "revisiting a state with a new context is not a cycle");
+    }
+
+    // Состояние отмечает выход в контексте и уходит дальше
+    class Leaver : public SM::State<Signal>
+    {
+      public:
+        Leaver()
+            : SM::State<Signal>("Leaver")
+        {
+        }
+
+        SM::Events::Base<Signal> update(
+            const SM::outsideParams &params) override
+        {
+            return SM::Events::Switch<Signal>{this, Signal::Next};
+        }
+
+        SM::Events::Base<Signal> exit(
+            const SM::outsideParams &params) override
+        {
+            SM::Events::Base<Signal> event{SM::Events::Type::None, this};
+            event.m_context = context().set("left", "1");
+            return event;
+        }
+    };
+
+    // Состояние отмечает вход в контексте из init() и запоминает, что
+    // видит update()
+    class Enterer : public SM::State<Signal>
+    {
+      public:
+        Enterer()
+            : SM::State<Signal>("Enterer")
+        {
+        }
+
+        SM::Events::Base<Signal> init(
+            const SM::outsideParams &params) override
+        {
+            SM::Events::Base<Signal> event{SM::Events::Type::None, this};
+            event.m_context = context().set("entered", "1");
+            return event;
+        }
+
+        SM::Events::Base<Signal> update(
+            const SM::outsideParams &params) override
+        {
+            m_saw_entered = context().get("entered") != nullptr;
+            m_saw_left = context().get("left") != nullptr;
+            return SM::Events::Base<Signal>{SM::Events::Type::None, this};
+        }
+
+        bool m_saw_entered = false;
+        bool m_saw_left = false;
+    };
+
+    class EnterScenario : public SM::Scenario<Signal>
+    {
+      public:
+        SM::Events::Base<Signal> init(const SM::outsideParams &) override
+        {
+            auto *leaver = addState<Leaver>();
+            m_enterer = addState<Enterer>();
+            addTransfer(leaver, m_enterer, Signal::Next);
+            setStartState(leaver);
+            return SM::Events::Base<Signal>(SM::Events::Type::None);
+        }
+
+        Enterer *m_enterer = nullptr;
+    };
+
+    // update() нового состояния в цепочке видит контекст из exit()
+    // старого и init() нового
+    void checkChainOrder()
+    {
+        EnterScenario scenario;
+        scenario.init({});
+        scenario.update({});
+        check(scenario.m_enterer->m_saw_left,
+              "update after Switch sees the context from exit()");
+        check(scenario.m_enterer->m_saw_entered,
+              "update after Switch sees the context from init()");
+    }
+
+    // Состояние запоминает каждое значение "v" в контексте сессии
+    class Collector : public SM::State<Signal>
+    {
+      public:
+        Collector()
+            : SM::State<Signal>("Collector", {"v"})
+        {
+        }
+
+        SM::Events::Base<Signal> update(
+            const SM::outsideParams &params) override
+        {
+            const std::string *value = param(0);
+            if (!value)
+                return SM::Events::Base<Signal>{SM::Events::Type::None,
+                                                this};
+            return SM::Events::Request{this, Signal::Next,
+                                       context().set(*value, "1")};
+        }
+    };
+
+    class CollectorScenario : public SM::Scenario<Signal>
+    {
+      public:
+        // broken - добавить недостижимое состояние и строгий анализ:
+        // такое описание не компилируется
+        CollectorScenario(bool broken = false)
+            : m_broken(broken)
+        {
+        }
+
+        SM::Events::Base<Signal> init(const SM::outsideParams &) override
+        {
+            setStartState(addState<Collector>());
+            if (m_broken)
+            {
+                addState<Counter>();
+                setStrictAnalysis(true);
+            }
+            return SM::Events::Base<Signal>(SM::Events::Type::None);
+        }
+
+      private:
+        bool m_broken;
+    };
+
+    // Контекст сценария сессии в SessionPool переживает update(), а
+    // сессии не видят контекст друг друга
+    void checkPoolContext()
+    {
+        SM::SessionPool<CollectorScenario> pool;
+        check(pool.addDefinition(
+                  std::make_unique<CollectorScenario>(true)) ==
+                  SM::SessionPool<CollectorScenario>::kNoDefinition,
+              "definition that cannot be frozen is rejected");
+        check(!pool.valid(pool.create(0)),
+              "session of an unknown definition is invalid");
+
+        auto definition =
+            pool.addDefinition(std::make_unique<CollectorScenario>());
+        auto first = pool.create(definition);
+        auto second = pool.create(definition);
+        pool.update(first, {{"v", "a"}});
+        pool.update(second, {{"v", "x"}});
+        auto event = pool.update(first, {{"v", "b"}});
+
+        check(event.m_context && event.m_context->get("a") &&
+                  event.m_context->get("b"),
+              "pool session keeps its context between updates");
+        check(event.m_context && !event.m_context->get("x"),
+              "pool sessions do not share contexts");
+        check(pool.memoryReport().m_context_sessions == 2,
+              "memory report counts session contexts");
+        pool.release(first);
+        check(pool.memoryReport().m_context_sessions == 1,
+              "release drops the session context");
+    }
+
+    // Состояние на каждый update() сразу уходит дальше
+    class Pass : public SM::State<Signal>
+    {
+      public:
+        using SM::State<Signal>::State;
+
+        SM::Events::Base<Signal> update(
+            const SM::outsideParams &params) override
+        {
+            return SM::Events::Switch<Signal>{this, Signal::Next};
+        }
+    };
+
+    // a -> b -> c, b - конечное; x ведет в a и недостижимо из a
+    class FinishScenario : public SM::Scenario<Signal>
+    {
+      public:
+        SM::Events::Base<Signal> init(const SM::outsideParams &) override
+        {
+            auto *a = addState<Pass>("a");
+            auto *b = addState<Pass>("b");
+            auto *c = addState<Pass>("c");
+            m_x = addState<Pass>("x");
+            addTransfer(a, b, Signal::Next);
+            addTransfer(b, c, Signal::Next);
+            addTransfer(m_x, a, Signal::Next);
+            setStartState(a);
+            setFinishState(b);
+            return SM::Events::Base<Signal>(SM::Events::Type::None);
+        }
+
+        void startFromX()
+        {
+            setStartState(m_x);
+        }
+
+      private:
+        SM::State<Signal> *m_x = nullptr;
+    };
+
+    std::string currentName(const FinishScenario &scenario)
+    {
+        auto *state = scenario.getCurrentState();
+        return state ? state->getName() : "<none>";
+    }
+
+    // Переходы из конечного состояния не срабатывают одинаково с
+    // компиляцией таблицы и без нее
+    void checkFinishStates()
+    {
+        for (bool frozen : {false, true})
+        {
+            std::string mode = frozen ? " (frozen)" : " (not frozen)";
+            FinishScenario scenario;
+            scenario.init({});
+            if (frozen)
+                check(scenario.freeze(), "freeze" + mode);
+            scenario.update({});
+            check(currentName(scenario) == "b",
+                  "chain stops in the finish state" + mode);
+            check(scenario.isFinished(), "session is finished" + mode);
+            scenario.update({});
+            check(currentName(scenario) == "b",
+                  "no transfer out of the finish state" + mode);
+        }
+
+        // Смена стартового состояния сбрасывает компиляцию: x был
+        // недостижим и не имел номера
+        FinishScenario scenario;
+        scenario.init({});
+        scenario.freeze();
+        scenario.startFromX();
+        check(!scenario.isFrozen(), "setStartState unfreezes");
+        check(scenario.getStartStateId() == FinishScenario::kNoState,
+              "no start id without a compiled table");
+        check(scenario.freeze(), "freeze with the new start state");
+        check(scenario.getStartStateId() != FinishScenario::kNoState,
+              "new start state gets an id");
+        scenario.update({});
+        check(currentName(scenario) == "b",
+              "new start state dispatches through the table");
+    }
+
+    // Scheduler удаляет сессию, как только ее сценарий завершился:
+    // оставшиеся сообщения отбрасываются, id можно занять снова
+    void checkSchedulerReclaim()
+    {
+        using Scheduler = SM::Scheduler<FinishScenario>;
+        auto make = [] {
+            auto scenario = std::make_unique<FinishScenario>();
+            scenario->init({});
+            return scenario;
+        };
+
+        Scheduler scheduler(Scheduler::Options{2});
+        check(scheduler.addSession(1, 0, make()), "add session");
+        for (int i = 0; i < 3; ++i)
+            check(scheduler.submit(1, {}), "submit before start");
+        scheduler.start();
+        scheduler.drain();
+
+        auto stats = scheduler.stats();
+        check(stats.m_processed == 1, "finished session stops processing");
+        check(stats.m_reclaimed == 1, "finished session is reclaimed");
+        check(stats.m_dropped == 2, "its queued messages are dropped");
+        check(!scheduler.submit(1, {}),
+              "reclaimed session rejects submit");
+        check(scheduler.addSession(1, 0, make()),
+              "reclaimed id can be added again");
+        check(scheduler.submit(1, {}), "new session accepts submit");
+        scheduler.drain();
+        check(scheduler.stats().m_reclaimed == 2,
+              "new session is reclaimed too");
+    }
+
+    // Состояние переходит по событию из параметра "e"
+    class Hop : public SM::State<Signal>
+    {
+      public:
+        Hop(const std::string &name)
+            : SM::State<Signal>(name, {"e"})
+        {
+        }
+
+        SM::Events::Base<Signal> update(
+            const SM::outsideParams &params) override
+        {
+            const std::string *event = param(0);
+            if (!event)
+                return SM::Events::Base<Signal>{SM::Events::Type::None,
+                                                this};
+            return SM::Events::Switch<Signal>{this,
+                                              Signal(std::stoi(*event))};
+        }
+    };
+
+    constexpr int kHopStates = 40;
+    constexpr int kHopEvents = 6;
+
+    // Случайный граф: у части состояний по некоторым событиям перехода
+    // нет, часть состояний недостижима из стартового
+    class HopScenario : public SM::Scenario<Signal>
+    {
+      public:
+        SM::Events::Base<Signal> init(const SM::outsideParams &) override
+        {
+            std::mt19937 rng(5);
+            std::vector<Hop *> states;
+            for (int i = 0; i < kHopStates; ++i)
+                states.push_back(
+                    addState<Hop>("h" + std::to_string(rng() % 1000) +
+                                  "_" + std::to_string(i)));
+            for (int i = 0; i < kHopStates; ++i)
+                for (int e = 0; e < kHopEvents; ++e)
+                    if (rng() % 4)
+                        addTransfer(states[i],
+                                    states[rng() % (kHopStates - 5)],
+                                    Signal(e));
+            setStartState(states[0]);
+            return SM::Events::Base<Signal>(SM::Events::Type::None);
+        }
+    };
+
+    // Последовательность состояний после каждого update() одинакова
+    // для std::map, скомпилированной таблицы и таблицы с профилем
+    void checkLayouts()
+    {
+        std::mt19937 rng(6);
+        std::vector<SM::outsideParams> inputs;
+        for (int step = 0; step < 2000; ++step)
+            inputs.push_back({{"e", std::to_string(rng() % kHopEvents)}});
+
+        auto trace = [&inputs](HopScenario &scenario) {
+            std::vector<std::string> states;
+            for (const auto &input : inputs)
+            {
+                scenario.update(input);
+                states.push_back(scenario.getCurrentState()->getName());
+            }
+            return states;
+        };
+
+        HopScenario by_map;
+        by_map.init({});
+        auto expected = trace(by_map);
+        check(std::set<std::string>(expected.begin(), expected.end())
+                      .size() > kHopStates / 2,
+              "random walk covers the graph");
+
+        HopScenario frozen;
+        frozen.init({});
+        check(frozen.freeze(), "random graph freezes");
+        frozen.setProfiling(true);
+        check(trace(frozen) == expected,
+              "frozen table visits the same states as std::map");
+
+        auto profile = frozen.exportProfile();
+        HopScenario guided;
+        guided.init({});
+        check(guided.freeze(&profile),
+              "random graph freezes with profile");
+        check(trace(guided) == expected,
+              "profiled table visits the same states as std::map");
+    }
+
+    // Перекомпиляция описания в SessionPool по профилю меняет номера
+    // состояний, но каждая сессия остается в своем состоянии
+    void checkRelayout()
+    {
+        SM::SessionPool<HopScenario> pool;
+        auto definition =
+            pool.addDefinition(std::make_unique<HopScenario>());
+        pool.setProfiling(definition, true);
+
+        std::mt19937 rng(7);
+        std::vector<SM::SessionHandle> sessions;
+        for (int i = 0; i < 200; ++i)
+        {
+            sessions.push_back(pool.create(definition));
+            for (int step = 0; step < 5; ++step)
+                pool.update(sessions.back(),
+                            {{"e", std::to_string(rng() % kHopEvents)}});
+        }
+
+        const auto &scenario = pool.definition(definition);
+        auto names = [&] {
+            std::vector<std::string> result;
+            for (auto handle : sessions)
+                result.push_back(
+                    scenario.getStateName(pool.stateId(handle)));
+            return result;
+        };
+        auto before = names();
+        std::vector<std::uint16_t> old_ids;
+        for (auto handle : sessions)
+            old_ids.push_back(pool.stateId(handle));
+
+        auto profile = scenario.exportProfile();
+        check(pool.relayout(definition, &profile), "relayout by profile");
+        std::vector<std::uint16_t> new_ids;
+        for (auto handle : sessions)
+            new_ids.push_back(pool.stateId(handle));
+        check(new_ids != old_ids, "profile changes state ids");
+        check(names() == before, "sessions keep their states by name");
+        check(!pool.relayout(definition + 1, nullptr),
+              "unknown definition is not relaid out");
+    }
+
+    // Уплотнение FileColdStore: при постоянной перезаписи файл не
+    // растет дальше примерно двух объемов живых записей, а записи
+    // читаются без искажений
+    void checkFileColdStore()
+    {
+        const std::string path = "structure_checks_cold.bin";
+        SM::FileColdStore store(path);
+        std::string data(1000, ' '), out;
+        bool bounded = true;
+        for (int round = 0; round < 50; ++round)
+            for (SM::SessionId id = 0; id < 100; ++id)
+            {
+                data[0] = 'a' + round % 26;
+                data[1] = 'a' + id % 26;
+                store.put(id, data);
+                bounded = bounded &&
+                          store.fileBytes() <=
+                              2 * store.bytes() +
+                                  SM::FileColdStore::kCompactMinBytes +
+                                  data.size();
+            }
+        check(bounded, "cold file stays within twice the live bytes");
+        check(store.size() == 100 && store.bytes() == 100 * data.size(),
+              "cold store counts live records");
+
+        bool intact = true;
+        for (SM::SessionId id = 0; id < 100; ++id)
+            intact = intact && store.take(id, out) &&
+                     out.size() == data.size() &&
+                     out[0] == 'a' + 49 % 26 && out[1] == 'a' + id % 26;
+        check(intact, "records survive compaction");
+        check(store.size() == 0 && store.bytes() == 0,
+              "take removes records");
+        std::remove(path.c_str());
+    }
+
+    // Холодное хранилище, которое портит записи при чтении
+    class CorruptColdStore : public SM::MemoryColdStore
+    {
+      public:
+        bool take(SM::SessionId id, std::string &data) override
+        {
+            if (!SM::MemoryColdStore::take(id, data))
+                return false;
+            data.assign(1, '\xff');
+            return true;
+        }
+    };
+
+    // SessionStore: восстановление контекста из холодного уровня,
+    // удаление по бюджету холодных байт и учет испорченных записей
+    void checkSessionStore()
+    {
+        using Store = SM::SessionStore<CollectorScenario>;
+        auto factory = [] {
+            return std::make_unique<CollectorScenario>();
+        };
+
+        Store store(factory, Store::Budget{1, 0});
+        store.update(1, {{"v", "a"}});
+        store.update(2, {{"v", "x"}});
+        check(store.hotCount() == 1 && store.coldCount() == 1,
+              "hot budget moves the older session to the cold tier");
+        auto event = store.update(1, {{"v", "b"}});
+        check(store.metrics().m_rehydrations == 1,
+              "cold session is rehydrated");
+        check(event.m_context && event.m_context->get("a") &&
+                  event.m_context->get("b") && !event.m_context->get("x"),
+              "rehydrated session keeps its context");
+
+        Store small(factory, Store::Budget{1, 64});
+        for (SM::SessionId id = 0; id < 100; ++id)
+            small.update(id, {{"v", "value-" + std::to_string(id)}});
+        check(small.metrics().m_dropped > 0,
+              "cold byte budget drops old sessions");
+        check(small.coldBytes() <= 64, "cold bytes stay within budget");
+
+        Store corrupt(factory, Store::Budget{1, 0},
+                      std::make_unique<CorruptColdStore>());
+        corrupt.update(1, {{"v", "a"}});
+        corrupt.update(2, {{"v", "b"}});
+        check(!corrupt.acquire(1), "corrupt cold record is not loaded");
+        check(corrupt.metrics().m_dropped == 1,
+              "corrupt cold record is counted as dropped");
+        check(corrupt.coldCount() == 0, "corrupt record is removed");
+    }
+} // namespace
+
+int main()
+{
+    SM::Log::setSink(nullptr);
+
+    checkKeySet();
+    checkParam();
+    checkContext();
+    checkContextChain();
+    checkChainOrder();
+    checkPoolContext();
+    checkFinishStates();
+    checkSchedulerReclaim();
+    checkLayouts();
+    checkRelayout();
+    checkFileColdStore();
+    checkSessionStore();
+
+    if (g_failures)
+        std::cerr << g_failures << " checks failed\n";
+    else
+        std::cerr << "all checks passed\n";
+    return g_failures ? 1 : 0;
+}
@@ -0,0 +1,194 @@
+#ifndef UPDATEPASSWORD_HPP
+#define UPDATEPASSWORD_HPP
+
+#include <iostream>
+#include <libstate.hpp>
+
+
+inline void printMap(const std::map<std::string, std::string>& m) {
+    SM_LOG("\n");
+    for (const auto& [key, value] : m) {
+        SM_LOG(key << ": " << value << "\n");
+    }
+    SM_LOG("\n");
+}
+
+
+namespace Settings
+{
+    enum class CustomNames
+    {
+    };
+
+    enum class CustomEvents : short
+    {
+        GotPassword,
+        PasswordIsCorrect,
+        PasswordIsIncorrect,
+        PasswordIsEmpty,
+        SavePassword,
+        TryAgain,
+    };
+
+    // Номер ключа "password" в списке ключей, объявленных состоянием
+    constexpr std::size_t kPassword = 0;
+
+    using MyState = SM::State<CustomEvents>;
+    using MyEvent = SM::Events::Base<CustomEvents>;
+    using MyScenario = SM::Scenario<CustomEvents>;
+
+} // namespace Settings
+
+namespace States
+{
+    class RequestOldPassword : public Settings::MyState
+    {
+      public:
+        RequestOldPassword()
+            : Settings::MyState("RequestOldPassword", {"password"}){};
+
+        virtual Settings::MyEvent update(
+            const SM::outsideParams &prams) override
+        {
+            printMap(prams);
+            // если пароль есть, нужно его проверить
+            const std::string *password = param(Settings::kPassword);
+            if (password && password->length() > 0)
+            {
+                SM_LOG("===> " << getName() << ": got password\n");
+
+                // пароль едет дальше в контексте сессии
+                return SM::Events::Switch{
+                    this, Settings::CustomEvents::GotPassword,
+                    context().set("old_password", *password)};
+            }
+            SM_LOG("===> " << getName() << ": PasswordIsEmpty\n");
+
+            // если пароля нет
+            return SM::Events::Request{
+                this, Settings::CustomEvents::PasswordIsEmpty};
+        }
+    };
+
+    class CheckPassword : public Settings::MyState
+    {
+      public:
+        CheckPassword()
+            : Settings::MyState("CheckPassword"){};
+
+        virtual Settings::MyEvent update(
+            const SM::outsideParams &prams) override
+        {
+            printMap(prams);
+            const std::string *password = context().get("old_password");
+            // Старый пароль больше не нужен ни при каком исходе
+            if (password && isPassworCorrect(*password))
+            {
+                SM_LOG("===> " << getName() << ": PasswordIsCorrect\n");
+                return SM::Events::Switch{
+                    this, Settings::CustomEvents::PasswordIsCorrect,
+                    context().erase("old_password")};
+            }
+
+            SM_LOG("===> " << getName() << ": PasswordIsIncorrect\n");
+            return SM::Events::Switch{
+                this, Settings::CustomEvents::PasswordIsIncorrect,
+                context().erase("old_password")};
+        }
+
+      private:
+        bool isPassworCorrect(const std::string &password)
+        {
+
+            SM_LOG("===> " << getName() << ": is passwor Correct\n");
+            return password == "123";
+        }
+    };
+
+    class RequestNewPassword : public Settings::MyState
+    {
+      public:
+        RequestNewPassword()
+            : Settings::MyState("RequestNewPassword", {"password"}){};
+
+        virtual Settings::MyEvent update(
+            const SM::outsideParams &prams) override
+        {
+            printMap(prams);
+            const std::string *password = param(Settings::kPassword);
+            if (password && password->length() > 0)
+            {
+                SM_LOG("===> " << getName() << ": GotPassword\n");
+                return SM::Events::Switch{
+                    this, Settings::CustomEvents::GotPassword,
+                    context().set("new_password", *password)};
+            }
+
+            SM_LOG("===> " << getName() << ": PasswordIsEmpty\n");
+
+            return SM::Events::Request{
+                this, Settings::CustomEvents::PasswordIsEmpty};
+        }
+    };
+
+    class SavePassword : public Settings::MyState
+    {
+      public:
+        SavePassword()
+            : Settings::MyState("SavePassword"){};
+
+        virtual Settings::MyEvent update(
+            const SM::outsideParams &prams) override
+        {
+            printMap(prams);
+            const std::string *password = context().get("new_password");
+            if (password && password->length() > 0)
+            {
+                SM_LOG("===> " << getName() << ": PasswordIsCorrect\n");
+                // наружу уходит весь контекст: старый и новый пароль
+                return SM::Events::Request{
+                    this, Settings::CustomEvents::PasswordIsCorrect,
+                    context()};
+            }
+                SM_LOG("===> " << getName() << ": PasswordIsEmpty\n");
+
+            return SM::Events::Request{
+                this, Settings::CustomEvents::PasswordIsEmpty};
+        }
+    };
+} // namespace States
+
+class UpdatePassword : public Settings::MyScenario
+{
+  public:
+    virtual Settings::MyEvent init(
+        const SM::outsideParams &params) override
+    {
+
+        SM_LOG("Добавление событий\n");
+        // Добавляем состояния
+        auto cp = addState<States::CheckPassword>();
+        auto rnp = addState<States::RequestNewPassword>();
+        auto rop = addState<States::RequestOldPassword>();
+        auto sp = addState<States::SavePassword>();
+
+        SM_LOG("Добавление переходов\n");
+        // Добавляем переходы между состояниями
+        addTransfer(rop, cp, Settings::CustomEvents::GotPassword);
+        addTransfer(rop, rop, Settings::CustomEvents::TryAgain);
+        addTransfer(cp, rop, Settings::CustomEvents::PasswordIsIncorrect);
+        addTransfer(cp, rnp, Settings::CustomEvents::PasswordIsCorrect);
+        addTransfer(rnp, rnp, Settings::CustomEvents::TryAgain);
+        addTransfer(rnp, sp, Settings::CustomEvents::GotPassword);
+        addTransfer(sp, rnp, Settings::CustomEvents::PasswordIsEmpty);
+
+        SM_LOG("Установка граничных состояний\n");
+        // Установка граничных состояний
+        setStartState(rop);
+        // setFinishState(sp);
+
+        return Settings::MyEvent(SM::Events::Type::None);
+    }
+};
+
+#endif // !UPDATEPASSWORD_HPP
@@ -0,0 +1,198 @@
+#ifndef CONTEXT_HPP
+#define CONTEXT_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Пространство имен библиотеки состояний
+namespace SM
+{
+    // Неизменяемый словарь строк со структурным разделением (treap с
+    // копированием пути). set()/erase() возвращают новую версию за
+    // O(log n), не копируя остальные записи; старые версии остаются
+    // валидными, поэтому копия Context - это бесплатный снимок.
+    class Context
+    {
+      public:
+        Context() = default;
+
+        /// @brief Найти значение по ключу
+        /// @return Указатель на значение или nullptr
+        const std::string *get(std::string_view key) const
+        {
+            const Node *node = m_root.get();
+            while (node)
+            {
+                int cmp = key.compare(node->m_entry->first);
+                if (!cmp)
+                    return &node->m_entry->second;
+                node = (cmp < 0 ? node->m_left : node->m_right).get();
+            }
+            return nullptr;
+        }
+
+        /// @brief Новая версия с добавленной или замененной записью
+        Context set(std::string key, std::string value) const
+        {
+            auto entry = std::make_shared<const Entry>(std::move(key),
+                                                       std::move(value));
+            bool added = false;
+            Context result;
+            result.m_root = insert(m_root, entry, priority(entry->first),
+                                   added);
+            result.m_size = m_size + (added ? 1 : 0);
+            return result;
+        }
+
+        /// @brief Новая версия без записи с ключом key
+        Context erase(std::string_view key) const
+        {
+            if (!get(key))
+                return *this;
+            Context result;
+            result.m_root = remove(m_root, key);
+            result.m_size = m_size - 1;
+            return result;
+        }
+
+        /// @brief Обойти записи в порядке возрастания ключей
+        /// @param visit Вызывается как visit(key, value)
+        template <typename Visitor>
+        void forEach(Visitor &&visit) const
+        {
+            walk(m_root.get(), visit);
+        }
+
+        std::size_t size() const
+        {
+            return m_size;
+        }
+
+        bool empty() const
+        {
+            return m_size == 0;
+        }
+
+        /// @brief Являются ли версии одним и тем же снимком
+        bool sameVersion(const Context &other) const
+        {
+            return m_root == other.m_root;
+        }
+
+      private:
+        using Entry = std::pair<const std::string, const std::string>;
+
+        struct Node
+        {
+            // Запись разделяется между версиями, при копировании пути
+            // копируется только указатель
+            std::shared_ptr<const Entry> m_entry;
+            std::size_t m_priority;
+            std::shared_ptr<const Node> m_left;
+            std::shared_ptr<const Node> m_right;
+        };
+
+        using NodePtr = std::shared_ptr<const Node>;
+        // Узлы, созданные в текущей операции, еще можно менять
+        using FreshPtr = std::shared_ptr<Node>;
+
+        // Приоритет зависит только от ключа: одинаковый набор ключей
+        // всегда дает одинаковое дерево
+        static std::size_t priority(std::string_view key)
+        {
+            return std::hash<std::string_view>{}(key) * 0x9e3779b97f4a7c15ull;
+        }
+
+        static FreshPtr insert(const NodePtr &node,
+                               const std::shared_ptr<const Entry> &entry,
+                               std::size_t prio, bool &added)
+        {
+            if (!node)
+            {
+                added = true;
+                return std::make_shared<Node>(
+                    Node{entry, prio, nullptr, nullptr});
+            }
+
+            auto copy = std::make_shared<Node>(*node);
+            int cmp = entry->first.compare(node->m_entry->first);
+            if (!cmp)
+            {
+                copy->m_entry = entry;
+                return copy;
+            }
+            if (cmp < 0)
+            {
+                auto left = insert(node->m_left, entry, prio, added);
+                if (left->m_priority <= copy->m_priority)
+                {
+                    copy->m_left = left;
+                    return copy;
+                }
+                // Поворот вправо
+                copy->m_left = left->m_right;
+                left->m_right = copy;
+                return left;
+            }
+            auto right = insert(node->m_right, entry, prio, added);
+            if (right->m_priority <= copy->m_priority)
+            {
+                copy->m_right = right;
+                return copy;
+            }
+            // Поворот влево
+            copy->m_right = right->m_left;
+            right->m_left = copy;
+            return right;
+        }
+
+        static NodePtr remove(const NodePtr &node, std::string_view key)
+        {
+            int cmp = key.compare(node->m_entry->first);
+            if (!cmp)
+                return merge(node->m_left, node->m_right);
+            auto copy = std::make_shared<Node>(*node);
+            if (cmp < 0)
+                copy->m_left = remove(node->m_left, key);
+            else
+                copy->m_right = remove(node->m_right, key);
+            return copy;
+        }
+
+        // Слияние поддеревьев: все ключи left меньше ключей right
+        static NodePtr merge(const NodePtr &left, const NodePtr &right)
+        {
+            if (!left)
+                return right;
+            if (!right)
+                return left;
+            if (left->m_priority > right->m_priority)
+            {
+                auto copy = std::make_shared<Node>(*left);
+                copy->m_right = merge(left->m_right, right);
+                return copy;
+            }
+            auto copy = std::make_shared<Node>(*right);
+            copy->m_left = merge(left, right->m_left);
+            return copy;
+        }
+
+        template <typename Visitor>
+        static void walk(const Node *node, Visitor &visit)
+        {
+            if (!node)
+                return;
+            walk(node->m_left.get(), visit);
+            visit(node->m_entry->first, node->m_entry->second);
+            walk(node->m_right.get(), visit);
+        }
+
+        NodePtr m_root;
+        std::size_t m_size = 0;
+    };
+} // namespace SM
+
+#endif // !CONTEXT_HPP
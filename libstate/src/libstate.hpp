@@ -1,14 +1,34 @@
 #ifndef LIBSTATE_HPP
 #define LIBSTATE_HPP
 
+#include "context.hpp"
+
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <list>
 #include <map>
 #include <memory>
 #include <optional>
+#include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Вывести сообщение в SM::Log::sink(), если вывод включен:
+// SM_LOG("State: " << name << "\n")
+#define SM_LOG(message)                                                   \
+    do                                                                    \
+    {                                                                     \
+        if (std::ostream *sm_log_sink = ::SM::Log::sink())                \
+            *sm_log_sink << message;                                      \
+    } while (0)
 
 // Пространство имен библиотеки состояний
 namespace SM
@@ -16,9 +36,81 @@ namespace SM
     // параметры полученные извне
     using outsideParams = std::map<std::string, std::string>;
 
+    // Идентификатор сессии (одного экземпляра сценария)
+    using SessionId = std::uint64_t;
+
+    // Отладочный вывод библиотеки. По умолчанию идет в std::cout;
+    // setSink(nullptr) выключает его вместе с форматированием
+    // сообщений, setSink(&stream) перенаправляет. Поток-получатель
+    // должен выдерживать запись из всех потоков, где работают
+    // сценарии.
+    namespace Log
+    {
+        inline std::atomic<std::ostream *> g_sink{&std::cout};
+
+        inline void setSink(std::ostream *sink)
+        {
+            g_sink.store(sink, std::memory_order_relaxed);
+        }
+
+        inline std::ostream *sink()
+        {
+            return g_sink.load(std::memory_order_relaxed);
+        }
+    } // namespace Log
+
+    // Компактное двоичное кодирование (сессии, трассы)
+    namespace Encoding
+    {
+        /// @brief Записать число в формате varint (7 бит на байт)
+        inline void writeVarint(std::string &out, std::uint64_t value)
+        {
+            while (value >= 0x80)
+            {
+                out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<char>(value));
+        }
+
+        /// @brief Прочитать число в формате varint
+        /// @return false, если данные закончились раньше числа
+        inline bool readVarint(const std::string &in, std::size_t &pos,
+                               std::uint64_t &value)
+        {
+            value = 0;
+            for (int shift = 0; pos < in.size() && shift < 64; shift += 7)
+            {
+                auto byte = static_cast<unsigned char>(in[pos++]);
+                value |= std::uint64_t(byte & 0x7f) << shift;
+                if (!(byte & 0x80))
+                    return true;
+            }
+            return false;
+        }
+    } // namespace Encoding
+
+    // Получатель входящего потока Scenario::update (например, запись
+    // трассы для нагрузочного тестирования)
+    class UpdateRecorder
+    {
+      public:
+        virtual ~UpdateRecorder()
+        {
+        }
+
+        /// @brief Вызывается перед обработкой данных сценарием
+        /// @param id Идентификатор сессии
+        /// @param params Данные, переданные в Scenario::update
+        virtual void record(SessionId id, const outsideParams &params) = 0;
+    };
+
     template <typename CustomEvents>
     class State;
 
+    template <typename CustomEvents>
+    class Scenario;
+
     namespace Events
     {
         // Стандартные события
@@ -39,6 +131,8 @@ namespace SM
             std::optional<CustomEvents> m_custom_data;
             State<CustomEvents> *m_sender_state = nullptr;
             outsideParams m_data;
+            // Новая версия контекста сессии (см. Scenario::getContext)
+            std::optional<Context> m_context;
 
             // Base();
             Base(Type type, State<CustomEvents> *state = nullptr,
@@ -59,6 +153,16 @@ namespace SM
                 , m_data(data)
             {
             }
+
+            Base(Type type, State<CustomEvents> *state,
+                 const CustomEvents &custom_event, const Context &context)
+                : m_type(type)
+                , m_custom_data(custom_event)
+                , m_sender_state(state)
+                , m_context(context)
+            {
+            }
+
             bool operator==(const Base &other) const
             {
                 return m_type == other.m_type &&
@@ -85,6 +189,14 @@ namespace SM
                                      data)
             {
             }
+
+            Switch(State<CustomEvents> *state,
+                   const CustomEvents &custom_event,
+                   const Context &context)
+                : Base<CustomEvents>(Type::Switch, state, custom_event,
+                                     context)
+            {
+            }
         };
 
         // Тип запроса, который отправляется куда-то
@@ -104,6 +216,14 @@ namespace SM
                                      data)
             {
             }
+
+            Request(State<CustomEvents> *state,
+                    const CustomEvents &custom_event,
+                    const Context &context)
+                : Base<CustomEvents>(Type::Request, state, custom_event,
+                                     context)
+            {
+            }
         };
 
         // Перезапуск текущего состояния
@@ -123,6 +243,14 @@ namespace SM
                                      data)
             {
             }
+
+            TryAgain(State<CustomEvents> *state,
+                     const CustomEvents &custom_event,
+                     const Context &context)
+                : Base<CustomEvents>(Type::TryAgain, state, custom_event,
+                                     context)
+            {
+            }
         };
 
         // Конец вветки переключения состояний
@@ -142,6 +270,14 @@ namespace SM
                                      data)
             {
             }
+
+            Finish(State<CustomEvents> *state,
+                   const CustomEvents &custom_event,
+                   const Context &context)
+                : Base<CustomEvents>(Type::Finish, state, custom_event,
+                                     context)
+            {
+            }
         };
 
         // Никакого события не произошло
@@ -160,17 +296,166 @@ namespace SM
                 : Base<CustomEvents>(Type::None, state, custom_event, data)
             {
             }
+
+            None(State<CustomEvents> *state,
+                 const CustomEvents &custom_event,
+                 const Context &context)
+                : Base<CustomEvents>(Type::None, state, custom_event,
+                                     context)
+            {
+            }
         };
 
     } // namespace Events
 
+    // Очередь фиксированной емкости без выделения памяти в куче
+    template <typename T, std::size_t Capacity>
+    class InlineQueue
+    {
+      public:
+        /// @brief Добавить элемент в конец
+        /// @return false, если очередь заполнена
+        bool push(T &&value)
+        {
+            if (m_size == Capacity)
+                return false;
+            m_items[(m_head + m_size) % Capacity].emplace(std::move(value));
+            ++m_size;
+            return true;
+        }
+
+        /// @brief Забрать элемент из начала
+        /// @return Элемент или std::nullopt, если очередь пуста
+        std::optional<T> pop()
+        {
+            if (!m_size)
+                return std::nullopt;
+            std::optional<T> value = std::move(m_items[m_head]);
+            m_items[m_head].reset();
+            m_head = (m_head + 1) % Capacity;
+            --m_size;
+            return value;
+        }
+
+        bool empty() const
+        {
+            return m_size == 0;
+        }
+
+      private:
+        std::array<std::optional<T>, Capacity> m_items;
+        std::size_t m_head = 0;
+        std::size_t m_size = 0;
+    };
+
+    // Набор ключей входных данных, объявленных состояниями сценария.
+    // Ключам назначаются плотные номера слотов, поиск слота по ключу
+    // идет через идеальный хеш: одно вычисление хеша и одно сравнение
+    // строк.
+    class KeySet
+    {
+      public:
+        static constexpr int kUndeclared = -1;
+
+        /// @brief Объявить ключ
+        /// @return Номер слота ключа (повторное объявление возвращает
+        /// тот же номер)
+        std::uint16_t add(const std::string &key)
+        {
+            for (std::size_t i = 0; i < m_keys.size(); ++i)
+                if (m_keys[i] == key)
+                    return i;
+            m_keys.push_back(key);
+            m_built = false;
+            return m_keys.size() - 1;
+        }
+
+        /// @brief Найти слот ключа
+        /// @return Номер слота или kUndeclared (в том числе после add()
+        /// без build())
+        int find(std::string_view key) const
+        {
+            if (m_keys.empty() || !m_built)
+                return kUndeclared;
+            int slot = m_table[hash(key, m_seed) & m_mask];
+            return slot != kUndeclared && m_keys[slot] == key ? slot
+                                                              : kUndeclared;
+        }
+
+        /// @brief Построить идеальный хеш по объявленным ключам
+        void build()
+        {
+            if (m_built)
+                return;
+            std::size_t size = 1;
+            while (size < m_keys.size() * 2)
+                size <<= 1;
+            // Подбираем затравку без коллизий; если долго не выходит,
+            // увеличиваем таблицу
+            for (m_seed = 0;; ++m_seed)
+            {
+                if (m_seed && m_seed % 256 == 0)
+                    size <<= 1;
+                m_mask = size - 1;
+                m_table.assign(size, kUndeclared);
+                bool collision = false;
+                for (std::size_t i = 0; i < m_keys.size() && !collision;
+                     ++i)
+                {
+                    auto &cell = m_table[hash(m_keys[i], m_seed) & m_mask];
+                    collision = cell != kUndeclared;
+                    cell = i;
+                }
+                if (!collision)
+                    break;
+            }
+            m_built = true;
+        }
+
+        bool isBuilt() const
+        {
+            return m_built;
+        }
+
+        std::size_t size() const
+        {
+            return m_keys.size();
+        }
+
+      private:
+        // FNV-1a с затравкой
+        static std::uint64_t hash(std::string_view key, std::uint64_t seed)
+        {
+            std::uint64_t h = 14695981039346656037ull ^ (seed * 0x9e3779b9);
+            for (char c : key)
+            {
+                h ^= static_cast<unsigned char>(c);
+                h *= 1099511628211ull;
+            }
+            return h ^ (h >> 29);
+        }
+
+        std::vector<std::string> m_keys;
+        std::vector<int> m_table;
+        std::uint64_t m_seed = 0;
+        std::uint64_t m_mask = 0;
+        bool m_built = true;
+    };
+
+    // Значения входных данных, разложенные по слотам KeySet
+    using ParamSlots = std::vector<const std::string *>;
+
     // Структура описывает состояние в текущем сценарии
     template <typename CustomEvents = void>
     class State
     {
       public:
-        State(const std::string &name)
+        /// @param name Имя состояния
+        /// @param keys Ключи входных данных, которые читает состояние
+        /// (см. param())
+        State(const std::string &name, std::vector<std::string> keys = {})
             : m_name(name)
+            , m_keys(std::move(keys))
         {
         }
 
@@ -214,8 +499,110 @@ namespace SM
             return m_name;
         }
 
+        /// @brief Получить номер состояния в скомпилированной таблице
+        /// переходов (назначается Scenario::freeze())
+        std::uint16_t getId() const
+        {
+            return m_id;
+        }
+
+        /// @brief Получить ключи входных данных, объявленные состоянием
+        const std::vector<std::string> &getKeys() const
+        {
+            return m_keys;
+        }
+
       protected:
+        /// @brief Значение объявленного ключа из текущих входных данных
+        /// @param key Номер ключа в списке, переданном в конструктор
+        /// @return Указатель на значение или nullptr, если ключа нет во
+        /// входных данных или такой ключ не объявлен
+        const std::string *param(std::size_t key) const
+        {
+            if (!m_slots || key >= m_key_slots.size() ||
+                m_key_slots[key] >= m_slots->size())
+                return nullptr;
+            return (*m_slots)[m_key_slots[key]];
+        }
+
+        /// @brief Контекст сессии: данные, накопленные состояниями
+        /// сценария. Новая версия передается в событии (например,
+        /// Switch{this, event, context().set(key, value)}).
+        const Context &context() const
+        {
+            static const Context empty;
+            return m_context ? *m_context : empty;
+        }
+
         std::string m_name;
+
+      private:
+        template <typename>
+        friend class Scenario;
+
+        std::uint16_t m_id = 0;
+        std::vector<std::string> m_keys;
+        // Слоты объявленных ключей и значения, которые раскладывает
+        // сценарий перед вызовом состояния
+        std::vector<std::uint16_t> m_key_slots;
+        const ParamSlots *m_slots = nullptr;
+        const Context *m_context = nullptr;
+    };
+
+    // Частоты переходов, собранные во время работы сценария. Ключ -
+    // имя состояния и событие, поэтому профиль можно собрать с одних
+    // экземпляров сценария и применить к другим.
+    template <typename CustomEvents = void>
+    struct TransitionProfile
+    {
+        std::map<std::pair<std::string, CustomEvents>, std::uint64_t>
+            m_counts;
+
+        /// @brief Добавить частоты из другого профиля
+        void merge(const TransitionProfile &other)
+        {
+            for (const auto &[key, count] : other.m_counts)
+                m_counts[key] += count;
+        }
+    };
+
+    // Результат анализа графа переходов (Scenario::analyze)
+    struct GraphReport
+    {
+        // Состояния, недостижимые из стартового
+        std::vector<std::string> m_unreachable;
+        // Не конечные состояния без исходящих переходов: сессия в них
+        // застревает
+        std::vector<std::string> m_dead_ends;
+        // Состояния, из которых не достичь ни одного конечного
+        std::vector<std::string> m_no_finish;
+        // Переходы, переопределенные повторным addTransfer
+        std::vector<std::string> m_shadowed;
+        // Переходы из конечных состояний: сессия завершается раньше
+        std::vector<std::string> m_dead_transfers;
+
+        /// @brief Нет ли замечаний
+        bool ok() const
+        {
+            return m_unreachable.empty() && m_dead_ends.empty() &&
+                   m_no_finish.empty() && m_shadowed.empty() &&
+                   m_dead_transfers.empty();
+        }
+
+        /// @brief Вывести замечания
+        void print(std::ostream &out) const
+        {
+            auto list = [&out](const char *title,
+                               const std::vector<std::string> &items) {
+                for (const auto &item : items)
+                    out << title << ": " << item << "\n";
+            };
+            list("Unreachable state", m_unreachable);
+            list("Dead end state", m_dead_ends);
+            list("No way to finish from state", m_no_finish);
+            list("Shadowed transfer", m_shadowed);
+            list("Dead transfer from finish state", m_dead_transfers);
+        }
     };
 
     // Сценарий взаимодействия состояний
@@ -232,8 +619,60 @@ namespace SM
                  State<CustomEvents> *>
             m_transfers;
 
+        // Скомпилированная таблица переходов (после freeze()). Строки
+        // лежат подряд в порядке номеров состояний, внутри строки
+        // переходы отсортированы по убыванию частоты.
+        struct Edge
+        {
+            CustomEvents m_event;
+            std::uint16_t m_target;
+        };
+
+        struct Row
+        {
+            // Биты событий, по которым из состояния есть переход
+            // (eventBit): отсутствие перехода проверяется без обхода
+            // строки
+            std::uint64_t m_events;
+            std::uint32_t m_offset;
+            std::uint16_t m_count;
+        };
+
+        std::vector<State<CustomEvents> *> m_compiled_states;
+        std::vector<Row> m_rows;
+        std::vector<Edge> m_edges;
+        // Счетчики переходов, отдельно от m_edges, чтобы не раздувать
+        // горячие строки
+        std::vector<std::uint64_t> m_edge_hits;
+        bool m_frozen = false;
+        bool m_profiling = false;
+        // Не компилировать таблицу, если анализ графа нашел замечания
+        bool m_strict_analysis = false;
+
+        // Конечные состояния и признак завершения сессии
+        std::unordered_set<State<CustomEvents> *> m_finish_states;
+        bool m_finished = false;
+
+        // Переходы, переопределенные повторным addTransfer
+        std::vector<std::string> m_shadowed;
+
         // Текущее состояние
         State<CustomEvents> *m_cur_state;
+        State<CustomEvents> *m_start_state = nullptr;
+
+        // Объявленные ключи входных данных и их значения для текущего
+        // вызова состояния
+        KeySet m_keys;
+        ParamSlots m_slot_values;
+        bool m_reject_undeclared = false;
+        std::uint64_t m_undeclared_keys = 0;
+
+        // Контекст сессии, текущая версия
+        Context m_context;
+
+        // Запись входящего потока (не владеет)
+        UpdateRecorder *m_recorder = nullptr;
+        SessionId m_session_id = 0;
 
         /// @brief Установить загруженное состояние
         /// @param name имя состояния
@@ -242,11 +681,13 @@ namespace SM
             auto it = m_states.find(name);
             if (it != m_states.end())
             {
-                m_cur_state = it->second.get();
+                m_cur_state = m_start_state = it->second.get();
+                // Номера состояний зависят от стартового состояния
+                unfreeze();
                 // handleLibEvents(m_cur_state->init({}));
             }
             else
-                std::cout << "Unknown state: " << name << "\n";
+                SM_LOG("Unknown state: " << name << "\n");
         }
 
         /// @brief Установка начального состояния
@@ -258,11 +699,13 @@ namespace SM
             auto it = m_states.find(state->getName());
             if (it != m_states.end())
             {
-                m_cur_state = it->second.get();
+                m_cur_state = m_start_state = it->second.get();
+                // Номера состояний зависят от стартового состояния
+                unfreeze();
                 // handleLibEvents(m_cur_state->init({}));
             }
             else
-                std::cout << "Unknown state: " << state->getName() << "\n";
+                SM_LOG("Unknown state: " << state->getName() << "\n");
         }
 
         // /// @brief Отправить запрос
@@ -283,13 +726,18 @@ namespace SM
 
             if (m_states.count(name) > 0)
             {
-                std::cout << "Cannot add state (" << state->getName()
-                          << "): state already exists\n";
+                SM_LOG("Cannot add state (" << state->getName()
+                       << "): state already exists\n");
                 return nullptr;
             }
 
             auto* row_ptr_state = state.get();
-            std::cout << "State (" << name << ") added\n";
+            SM_LOG("State (" << name << ") added\n");
+            for (const auto &key : state->m_keys)
+                state->m_key_slots.push_back(m_keys.add(key));
+            state->m_slots = &m_slot_values;
+            state->m_context = &m_context;
+            unfreeze();
             m_states[state->getName()] = std::move(state);
             return row_ptr_state;
         }
@@ -310,20 +758,47 @@ namespace SM
         {
             if (!first_state || !second_state)
             {
-                std::cout << "ERROR: empty state "
-                          << (!first_state ? 1 : 0) << " "
-                          << (!second_state ? 1 : 0) << std::endl;
+                SM_LOG("ERROR: empty state "
+                       << (!first_state ? 1 : 0) << " "
+                       << (!second_state ? 1 : 0) << "\n");
                 return false;
             }
-            m_transfers[std::make_pair(first_state, custom_event)] =
-                second_state;
-            std::cout << "Added state handleLibEvents ("
-                      << first_state->getName() << ") -"
-                      << (short)custom_event << "-> ("
-                      << second_state->getName() << ")\n";
+            auto [it, added] = m_transfers.try_emplace(
+                std::make_pair(first_state, custom_event), second_state);
+            if (!added)
+            {
+                SM_LOG("WARNING: transfer (" << first_state->getName()
+                       << ") -" << (short)custom_event
+                       << "-> overridden\n");
+                m_shadowed.push_back(
+                    first_state->getName() + " -" +
+                    std::to_string((short)custom_event) + "-> " +
+                    second_state->getName() + " (was " +
+                    it->second->getName() + ")");
+                it->second = second_state;
+            }
+            unfreeze();
+            SM_LOG("Added state handleLibEvents ("
+                   << first_state->getName() << ") -"
+                   << (short)custom_event << "-> ("
+                   << second_state->getName() << ")\n");
             return true;
         }
 
+        /// @brief Отметить состояние как конечное: попав в него, сессия
+        /// завершается (isFinished()) и может быть сразу освобождена
+        /// @param state Состояние
+        void setFinishState(State<CustomEvents> *state)
+        {
+            if (!state || !m_states.count(state->getName()))
+            {
+                SM_LOG("Unknown finish state\n");
+                return;
+            }
+            m_finish_states.insert(state);
+            unfreeze();
+        }
+
         /// @brief Найти состояние по имени
         /// @param name Имя состояния
         /// @return Если состояние существует, указатель на него, иначе
@@ -336,58 +811,625 @@ namespace SM
             return nullptr;
         }
 
+      public:
+        /// @brief Проанализировать граф переходов: недостижимые и
+        /// тупиковые состояния, состояния без пути к конечному,
+        /// переопределенные переходы и переходы из конечных состояний
+        GraphReport analyze() const
+        {
+            GraphReport report;
+            report.m_shadowed = m_shadowed;
+
+            std::unordered_map<State<CustomEvents> *,
+                               std::vector<State<CustomEvents> *>>
+                forward, backward;
+            for (const auto &[key, to] : m_transfers)
+            {
+                if (m_finish_states.count(key.first))
+                {
+                    report.m_dead_transfers.push_back(
+                        key.first->getName() + " -" +
+                        std::to_string((short)key.second) + "-> " +
+                        to->getName());
+                    continue;
+                }
+                forward[key.first].push_back(to);
+                backward[to].push_back(key.first);
+            }
+
+            auto closure = [](auto &graph,
+                              std::vector<State<CustomEvents> *> stack) {
+                std::unordered_set<State<CustomEvents> *> seen(
+                    stack.begin(), stack.end());
+                while (!stack.empty())
+                {
+                    auto *state = stack.back();
+                    stack.pop_back();
+                    for (auto *next : graph[state])
+                        if (seen.insert(next).second)
+                            stack.push_back(next);
+                }
+                return seen;
+            };
+
+            auto reachable =
+                m_start_state ? closure(forward, {m_start_state})
+                              : std::unordered_set<State<CustomEvents> *>{};
+            auto finishing = closure(
+                backward, std::vector<State<CustomEvents> *>(
+                              m_finish_states.begin(), m_finish_states.end()));
+
+            for (const auto &[name, state] : m_states)
+            {
+                auto *raw = state.get();
+                if (m_start_state && !reachable.count(raw))
+                {
+                    report.m_unreachable.push_back(name);
+                    continue;
+                }
+                bool finish = m_finish_states.count(raw) > 0;
+                if (!finish && forward[raw].empty())
+                    report.m_dead_ends.push_back(name);
+                else if (!m_finish_states.empty() && !finishing.count(raw))
+                    report.m_no_finish.push_back(name);
+            }
+            return report;
+        }
+
+        /// @brief Запретить freeze() при замечаниях анализа графа (по
+        /// умолчанию замечания только выводятся)
+        void setStrictAnalysis(bool strict)
+        {
+            m_strict_analysis = strict;
+        }
+
+        /// @brief Завершена ли сессия: пришло событие Finish или сессия
+        /// попала в конечное состояние
+        bool isFinished() const
+        {
+            return m_finished;
+        }
+
+        /// @brief Скомпилировать таблицу переходов. Состояния получают
+        /// плотные номера: обход идет от стартового состояния, и первым
+        /// ставится самый частый переход, поэтому горячий путь занимает
+        /// соседние строки. Внутри строки частые переходы проверяются
+        /// первыми. Перед компиляцией выполняется analyze():
+        /// недостижимые состояния и переходы из конечных состояний в
+        /// таблицу не попадают. Любой addState/addTransfer/
+        /// setStartState/setFinishState сбрасывает компиляцию.
+        /// @param profile Частоты переходов (nullptr - порядок по именам)
+        /// @return Удалось ли скомпилировать таблицу
+        bool freeze(const TransitionProfile<CustomEvents> *profile = nullptr)
+        {
+            if (m_states.size() >= kNoState)
+            {
+                SM_LOG("Cannot freeze: too many states\n");
+                return false;
+            }
+
+            GraphReport report = analyze();
+            if (!report.ok())
+            {
+                if (std::ostream *log = Log::sink())
+                    report.print(*log);
+                if (m_strict_analysis)
+                {
+                    SM_LOG("Cannot freeze: graph analysis failed\n");
+                    return false;
+                }
+            }
+
+            auto frequency = [profile](State<CustomEvents> *from,
+                                       CustomEvents event) -> std::uint64_t {
+                if (!profile)
+                    return 0;
+                auto it = profile->m_counts.find(
+                    std::make_pair(from->getName(), event));
+                return it == profile->m_counts.end() ? 0 : it->second;
+            };
+
+            // Исходящие переходы и "горячесть" каждого состояния
+            std::unordered_map<State<CustomEvents> *,
+                               std::vector<std::pair<std::uint64_t,
+                                                     const Transfer *>>>
+                outgoing;
+            std::unordered_map<State<CustomEvents> *, std::uint64_t> heat;
+            for (const auto &transfer : m_transfers)
+            {
+                auto *from = transfer.first.first;
+                if (m_finish_states.count(from))
+                    continue;
+                auto count = frequency(from, transfer.first.second);
+                outgoing[from].emplace_back(count, &transfer);
+                heat[from] += count;
+                heat[transfer.second] += count;
+            }
+            for (auto &[from, edges] : outgoing)
+                std::stable_sort(edges.begin(), edges.end(),
+                                 [](const auto &a, const auto &b) {
+                                     return a.first > b.first;
+                                 });
+
+            // Корень обхода - стартовое состояние: недостижимые из него
+            // состояния номеров не получают. Без стартового состояния
+            // обходятся все по убыванию горячести.
+            std::vector<State<CustomEvents> *> roots;
+            for (const auto &[name, state] : m_states)
+            {
+                state->m_id = kNoState;
+                roots.push_back(state.get());
+            }
+            std::stable_sort(roots.begin(), roots.end(),
+                             [&heat](auto *a, auto *b) {
+                                 return heat[a] > heat[b];
+                             });
+            if (m_start_state)
+                roots.assign(1, m_start_state);
+
+            m_compiled_states.clear();
+            std::unordered_set<State<CustomEvents> *> placed;
+            std::vector<State<CustomEvents> *> stack;
+            for (auto *root : roots)
+            {
+                stack.push_back(root);
+                while (!stack.empty())
+                {
+                    auto *state = stack.back();
+                    stack.pop_back();
+                    if (!placed.insert(state).second)
+                        continue;
+                    state->m_id = m_compiled_states.size();
+                    m_compiled_states.push_back(state);
+                    // Самый частый преемник должен достаться следующим
+                    const auto &edges = outgoing[state];
+                    for (auto it = edges.rbegin(); it != edges.rend(); ++it)
+                        if (!placed.count(it->second->second))
+                            stack.push_back(it->second->second);
+                }
+            }
+
+            m_rows.clear();
+            m_edges.clear();
+            for (auto *state : m_compiled_states)
+            {
+                const auto &edges = outgoing[state];
+                Row row{0, std::uint32_t(m_edges.size()),
+                        std::uint16_t(edges.size())};
+                for (const auto &edge : edges)
+                {
+                    row.m_events |= eventBit(edge.second->first.second);
+                    m_edges.push_back(Edge{edge.second->first.second,
+                                           edge.second->second->m_id});
+                }
+                m_rows.push_back(row);
+            }
+            m_edge_hits.assign(m_edges.size(), 0);
+            m_frozen = true;
+            return true;
+        }
+
+        /// @brief Включить подсчет частот переходов (работает по
+        /// скомпилированной таблице, см. freeze())
+        void setProfiling(bool enabled)
+        {
+            m_profiling = enabled;
+        }
+
+        /// @brief Получить частоты переходов, собранные с момента
+        /// последнего freeze()
+        TransitionProfile<CustomEvents> exportProfile() const
+        {
+            TransitionProfile<CustomEvents> profile;
+            for (std::size_t id = 0; id < m_rows.size(); ++id)
+                for (std::uint32_t i = m_rows[id].m_offset;
+                     i < m_rows[id].m_offset + m_rows[id].m_count; ++i)
+                    if (m_edge_hits[i])
+                        profile.m_counts[std::make_pair(
+                            m_compiled_states[id]->getName(),
+                            m_edges[i].m_event)] += m_edge_hits[i];
+            return profile;
+        }
+
+        /// @brief Скомпилирована ли таблица переходов
+        bool isFrozen() const
+        {
+            return m_frozen;
+        }
+
+        /// @brief Номер текущего состояния (только после freeze())
+        /// @return Номер или kNoState, если состояние не задано или
+        /// таблица не скомпилирована
+        std::uint16_t getCurrentStateId() const
+        {
+            return m_frozen && m_cur_state ? m_cur_state->m_id : kNoState;
+        }
+
+        /// @brief Номер стартового состояния (только после freeze())
+        /// @return Номер или kNoState, если состояние не задано или
+        /// таблица не скомпилирована
+        std::uint16_t getStartStateId() const
+        {
+            return m_frozen && m_start_state ? m_start_state->m_id
+                                             : kNoState;
+        }
+
+        /// @brief Число состояний в скомпилированной таблице
+        std::size_t getStateCount() const
+        {
+            return m_frozen ? m_compiled_states.size() : 0;
+        }
+
+        /// @brief Имя состояния по номеру (только после freeze())
+        /// @return Имя или пустая строка, если номер неизвестен
+        std::string getStateName(std::uint16_t id) const
+        {
+            return id < getStateCount() ? m_compiled_states[id]->getName()
+                                        : std::string();
+        }
+
+        /// @brief Номер состояния по имени (только после freeze())
+        /// @return Номер или kNoState, если состояния нет в таблице
+        std::uint16_t getStateId(const std::string &name) const
+        {
+            auto it = m_states.find(name);
+            return m_frozen && it != m_states.end() ? it->second->m_id
+                                                    : kNoState;
+        }
+
+        /// @brief Перейти в состояние по номеру без вызова init/exit и
+        /// заменить контекст сессии. Позволяет одному описанию сценария
+        /// обслуживать много компактных сессий (см. SessionPool).
+        /// @param id Номер состояния или kNoState
+        /// @param context Контекст сессии (по умолчанию пустой)
+        /// @return false, если таблица не скомпилирована или номер
+        /// неизвестен
+        bool setCurrentStateId(std::uint16_t id, Context context = {})
+        {
+            if (!m_frozen ||
+                (id != kNoState && id >= m_compiled_states.size()))
+                return false;
+            m_cur_state = id == kNoState ? nullptr : m_compiled_states[id];
+            m_context = std::move(context);
+            m_finished = false;
+            return true;
+        }
+
       private:
-        /// @brief Обработка состояний библиотеки
+        using Transfer =
+            typename decltype(m_transfers)::value_type;
+
+        /// @brief Сбросить скомпилированную таблицу после изменения
+        /// описания сценария
+        void unfreeze()
+        {
+            if (m_frozen)
+                SM_LOG("Scenario changed, freeze() it again\n");
+            m_frozen = false;
+        }
+
+        /// @brief Разложить входные данные по слотам объявленных ключей
+        /// @param params Входные данные (должны жить, пока состояние их
+        /// читает)
+        /// @return Число необъявленных ключей во входных данных
+        std::size_t resolveSlots(const outsideParams &params)
+        {
+            std::size_t undeclared = layoutSlots(params);
+            m_undeclared_keys += undeclared;
+            return undeclared;
+        }
+
+        /// @brief Разложить входные данные по слотам, не учитывая
+        /// необъявленные ключи (повторная раскладка того же входа)
+        std::size_t layoutSlots(const outsideParams &params)
+        {
+            if (!m_keys.isBuilt())
+            {
+                m_keys.build();
+                m_slot_values.resize(m_keys.size());
+            }
+            std::fill(m_slot_values.begin(), m_slot_values.end(), nullptr);
+            std::size_t undeclared = 0;
+            for (const auto &[key, value] : params)
+            {
+                int slot = m_keys.find(key);
+                if (slot == KeySet::kUndeclared)
+                    ++undeclared;
+                else
+                    m_slot_values[slot] = &value;
+            }
+            return undeclared;
+        }
+
+        /// @brief Бит события в Row::m_events. События со значениями
+        /// от 63 делят последний бит.
+        static std::uint64_t eventBit(const CustomEvents &event)
+        {
+            auto value = static_cast<std::uint64_t>(event);
+            return std::uint64_t(1) << std::min<std::uint64_t>(value, 63);
+        }
+
+        /// @brief Найти переход из состояния по событию
+        /// @return Новое состояние или nullptr, если перехода нет
+        State<CustomEvents> *findTransfer(State<CustomEvents> *from,
+                                          const CustomEvents &event)
+        {
+            if (!m_frozen)
+            {
+                // Как и в скомпилированной таблице, из конечных
+                // состояний переходов нет
+                if (m_finish_states.count(from))
+                    return nullptr;
+                auto it = m_transfers.find(std::make_pair(from, event));
+                return it == m_transfers.end() ? nullptr : it->second;
+            }
+
+            if (from->m_id == kNoState)
+                return nullptr;
+            const Row &row = m_rows[from->m_id];
+            // Отсутствие перехода доказано при компиляции
+            if (!(row.m_events & eventBit(event)))
+                return nullptr;
+            for (std::uint32_t i = row.m_offset;
+                 i < row.m_offset + row.m_count; ++i)
+                if (m_edges[i].m_event == event)
+                {
+                    if (m_profiling)
+                        ++m_edge_hits[i];
+                    return m_compiled_states[m_edges[i].m_target];
+                }
+            return nullptr;
+        }
+
+        // Ограничения внутреннего цикла обработки одного update()
+        static constexpr std::size_t kInternalQueueCapacity = 4;
+        static constexpr std::size_t kCycleWindow = 16;
+
+        // Состояние внутреннего цикла обработки одного update()
+        struct Run
+        {
+            InlineQueue<Events::Base<CustomEvents>, kInternalQueueCapacity>
+                m_queue;
+            // Пары (состояние, отпечаток входа), уже обработанные в цикле
+            std::array<std::pair<State<CustomEvents> *, std::size_t>,
+                       kCycleWindow>
+                m_visited;
+            std::size_t m_visited_count = 0;
+            std::size_t m_steps = 0;
+            Events::Base<CustomEvents> m_result{Events::Type::None};
+            // Переход, данные которого новое состояние обработает после
+            // событий exit()/init() (см. runPending)
+            std::optional<Events::Base<CustomEvents>> m_pending;
+            State<CustomEvents> *m_pending_state = nullptr;
+        };
+
+        /// @brief Обработка состояний библиотеки. Вызывается для каждого
+        /// события внутреннего цикла до того, как сценарий его выполнит;
+        /// наследники переопределяют ее, чтобы наблюдать за событиями.
+        /// Переходы выполняет processEvent() независимо от этой функции.
         /// @param event Событие перехода
-        virtual void handleLibEvents(
-            const Events::Base<CustomEvents> &event)
+        virtual void handleLibEvents(const Events::Base<CustomEvents> &event)
         {
-            std::cout << "Got event with type: " << (uint)event.m_type
-                      << "\n";
+            SM_LOG("Got event with type: " << (uint)event.m_type << "\n");
             const auto &sender = event.m_sender_state;
             const auto &sender_name =
                 sender ? sender->getName() : "unknown";
 
-            // Обработка всех библиотечных событий
             switch (event.m_type)
             {
             case Events::Type::None:
-                std::cout << "Got Nothing from state: " << sender_name
-                          << "\n";
+                SM_LOG("Got Nothing from state: " << sender_name << "\n");
                 break;
             case Events::Type::Request:
-                std::cout << "Got Request from state: " << sender_name
-                          << "\n";
-                // TODO: поиск перехода
-
+                SM_LOG("Got Request from state: " << sender_name << "\n");
                 break;
             case Events::Type::Switch:
-                std::cout << "Got Switch from state: " << sender_name
-                          << "\n";
-
+                SM_LOG("Got Switch from state: " << sender_name << "\n");
                 break;
             case Events::Type::TryAgain:
-                std::cout << "Got TryAgain from state: " << sender_name
-                          << "\n";
-
+                SM_LOG("Got TryAgain from state: " << sender_name << "\n");
                 break;
             case Events::Type::Finish:
-                std::cout << "Got Finish from state: " << sender_name
-                          << "\n";
-
+                SM_LOG("Got Finish from state: " << sender_name << "\n");
                 break;
 
             default:
-                std::cout << "Unknown lib type: " << (uint)event.m_type
-                          << "\n";
+                SM_LOG("Unknown lib type: " << (uint)event.m_type << "\n");
             }
+        };
 
-            // Выходим из текущего состояния
+        /// @brief Выполнить событие внутреннего цикла
+        /// @param event Событие перехода
+        /// @param run Внутренний цикл, в который добавляются новые события
+        void processEvent(const Events::Base<CustomEvents> &event, Run &run)
+        {
+            handleLibEvents(event);
+
+            // Сценарий принимает версию контекста, которую прислало
+            // текущее состояние. Событие ушедшего состояния контекст не
+            // меняет.
+            if (event.m_context && event.m_sender_state == m_cur_state)
+                m_context = *event.m_context;
+
+            switch (event.m_type)
+            {
+            case Events::Type::Switch:
+                switchState(event, run);
+                return;
+            case Events::Type::TryAgain:
+                // Перезапускаем текущее состояние, новый вход придет со
+                // следующим update()
+                if (event.m_sender_state == m_cur_state)
+                {
+                    resolveSlots(event.m_data);
+                    leaveState(event.m_data, run);
+                    pushEvent(run, m_cur_state->init(event.m_data));
+                }
+                break;
+            case Events::Type::Finish:
+                m_finished = true;
+                break;
+            default:
+                break;
+            }
+
+            // Наружу отдается последнее содержательное событие
+            if (event.m_type != Events::Type::None ||
+                run.m_result.m_type == Events::Type::None)
+                run.m_result = event;
+        }
+
+        /// @brief Переход по событию Switch. Новое состояние
+        /// обработает данные события после событий exit()/init() (см.
+        /// runPending).
+        void switchState(const Events::Base<CustomEvents> &event, Run &run)
+        {
+            if (event.m_sender_state != m_cur_state ||
+                !event.m_custom_data)
+            {
+                SM_LOG("Ignored Switch: stale sender or no event\n");
+                return;
+            }
+            auto *next = findTransfer(m_cur_state, *event.m_custom_data);
+            if (!next)
+            {
+                SM_LOG("No transfer from state: "
+                       << m_cur_state->getName() << " by "
+                       << (short)*event.m_custom_data << "\n");
+                run.m_result = event;
+                return;
+            }
 
+            // Выходим из текущего состояния
+            resolveSlots(event.m_data);
+            leaveState(event.m_data, run);
             // Заходим в следующее состояние
-        };
+            m_cur_state = next;
+            SM_LOG("Switched to state: " << m_cur_state->getName()
+                   << "\n");
+            pushEvent(run, m_cur_state->init(event.m_data));
+
+            // В конечном состоянии цепочка останавливается
+            if (m_finish_states.count(m_cur_state))
+            {
+                m_finished = true;
+                run.m_result = event;
+                run.m_pending.reset();
+                return;
+            }
+            run.m_pending = event;
+            run.m_pending_state = m_cur_state;
+        }
+
+        /// @brief Событие exit() выполняется сразу, пока состояние еще
+        /// текущее: его контекст принимается, а Switch и TryAgain
+        /// игнорируются, так как переход уже идет
+        void leaveState(const outsideParams &params, Run &run)
+        {
+            auto event = m_cur_state->exit(params);
+            if (event.m_type == Events::Type::None && !event.m_context)
+                return;
+            if (event.m_type != Events::Type::Switch &&
+                event.m_type != Events::Type::TryAgain)
+            {
+                processEvent(event, run);
+                return;
+            }
+            handleLibEvents(event);
+            SM_LOG("Ignored transition from exit()\n");
+            if (event.m_context && event.m_sender_state == m_cur_state)
+                m_context = *event.m_context;
+        }
+
+        /// @brief Новое состояние обрабатывает данные перехода, пока не
+        /// исчерпан лимит шагов и тройка (состояние, данные, контекст)
+        /// не повторяется. Контекст из init() уже принят.
+        void runPending(Run &run)
+        {
+            Events::Base<CustomEvents> event = std::move(*run.m_pending);
+            run.m_pending.reset();
+            // Переход перекрыт другим Switch или Finish из init()
+            if (run.m_pending_state != m_cur_state || m_finished)
+                return;
+
+            if (run.m_steps >= m_max_internal_steps)
+            {
+                if (m_max_internal_steps)
+                    SM_LOG("Internal step limit reached\n");
+                stopAt(event, run);
+                return;
+            }
+            ++run.m_steps;
+
+            std::size_t print = fingerprint(event.m_data, m_context);
+            auto visited_end = run.m_visited.begin() + run.m_visited_count;
+            if (std::find(run.m_visited.begin(), visited_end,
+                          std::make_pair(m_cur_state, print)) != visited_end)
+            {
+                SM_LOG("Cycle detected at state: "
+                       << m_cur_state->getName() << "\n");
+                stopAt(event, run);
+                return;
+            }
+            if (run.m_visited_count < kCycleWindow)
+                run.m_visited[run.m_visited_count++] = {m_cur_state, print};
+
+            // Между переходом и этим шагом слоты могли занять данные
+            // других событий
+            layoutSlots(event.m_data);
+            pushEvent(run, m_cur_state->update(event.m_data));
+        }
+
+        /// @brief Остановить цепочку на переходе. Содержательное событие
+        /// из init() остается результатом.
+        static void stopAt(const Events::Base<CustomEvents> &event,
+                           Run &run)
+        {
+            if (run.m_result.m_type == Events::Type::None)
+                run.m_result = event;
+        }
+
+        /// @brief Добавить внутреннее событие в очередь цикла
+        static void pushEvent(Run &run, Events::Base<CustomEvents> &&event)
+        {
+            // Пустое событие нужно только ради нового контекста
+            if (event.m_type == Events::Type::None && !event.m_context)
+                return;
+            if (!run.m_queue.push(std::move(event)))
+                SM_LOG("Internal event queue is full, event dropped\n");
+        }
+
+        /// @brief Отпечаток входных данных и контекста для поиска
+        /// циклов: повтор состояния с другим контекстом циклом не
+        /// считается
+        static std::size_t fingerprint(const outsideParams &params,
+                                       const Context &context)
+        {
+            std::size_t seed = params.size();
+            std::hash<std::string_view> hasher;
+            auto mix = [&seed, &hasher](std::string_view key,
+                                        std::string_view value) {
+                seed ^= hasher(key) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+                seed ^= hasher(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+            };
+            for (const auto &[key, value] : params)
+                mix(key, value);
+            seed ^= context.size() + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+            context.forEach(mix);
+            return seed;
+        }
+
+        // Сколько переходов подряд выполняется за один update() без
+        // возврата наружу. 0 - новое состояние ждет следующего update()
+        std::size_t m_max_internal_steps = 8;
 
       public:
+        using Event = Events::Base<CustomEvents>;
+        using Profile = TransitionProfile<CustomEvents>;
+
+        // Номер "состояние не задано" в скомпилированной таблице
+        static constexpr std::uint16_t kNoState = 0xffff;
+
         Scenario()
             : m_cur_state(nullptr)
         {
@@ -411,17 +1453,157 @@ namespace SM
         virtual Events::Base<CustomEvents> update(
             const outsideParams &params)
         {
-            std::cout << "Updating Scenario\n";
+            SM_LOG("Updating Scenario\n");
+            if (m_recorder)
+                m_recorder->record(m_session_id, params);
+            if (!m_cur_state)
+            {
+                SM_LOG("Текущее состояние не задано!\n");
+                return Events::Base<CustomEvents>(Events::Type::None);
+            }
+
+            if (resolveSlots(params) && m_reject_undeclared)
+            {
+                SM_LOG("Rejected input with undeclared keys\n");
+                return Events::Base<CustomEvents>(Events::Type::None);
+            }
+
+            SM_LOG("Updating state: " << m_cur_state->getName() << "\n");
+            Run run;
+            run.m_visited[run.m_visited_count++] = {
+                m_cur_state, fingerprint(params, m_context)};
+            pushEvent(run, m_cur_state->update(params));
+
+            // Внутренние события обрабатываются до конца, не выходя
+            // наружу. update() нового состояния выполняется после
+            // событий exit()/init() перехода.
+            for (;;)
+            {
+                if (auto event = run.m_queue.pop())
+                    processEvent(*event, run);
+                else if (run.m_pending)
+                    runPending(run);
+                else
+                    break;
+            }
+            return run.m_result;
+        }
+
+        /// @brief Отклонять входные данные с ключами, которые не
+        /// объявило ни одно состояние (по умолчанию такие ключи
+        /// пропускаются)
+        void setRejectUndeclaredKeys(bool reject)
+        {
+            m_reject_undeclared = reject;
+        }
+
+        /// @brief Сколько необъявленных ключей пришло во входных данных
+        std::uint64_t undeclaredKeys() const
+        {
+            return m_undeclared_keys;
+        }
+
+        /// @brief Ограничить число переходов за один update()
+        /// @param steps Сколько новых состояний можно сразу обработать
+        /// (0 - переход выполняется, но новое состояние ждет следующего
+        /// update())
+        void setMaxInternalSteps(std::size_t steps)
+        {
+            m_max_internal_steps = steps;
+        }
+
+        /// @brief Подключить запись входящего потока update()
+        /// @param recorder Получатель (nullptr - отключить запись)
+        /// @param id Идентификатор сессии, с которым пишутся данные
+        void setRecorder(UpdateRecorder *recorder, SessionId id)
+        {
+            m_recorder = recorder;
+            m_session_id = id;
+        }
+
+        /// @brief Получить контекст сессии. Копия - это неизменяемый
+        /// снимок, он остается валидным после следующих update().
+        const Context &getContext() const
+        {
+            return m_context;
+        }
+
+        /// @brief Получить текущее состояние
+        /// @return Указатель на текущее состояние или nullptr
+        State<CustomEvents> *getCurrentState() const
+        {
+            return m_cur_state;
+        }
+
+        /// @brief Сохранить сессию (положение в сценарии) в компактном
+        /// виде. Сами состояния и переходы не сохраняются: они
+        /// восстанавливаются вызовом init().
+        /// @param out Буфер, в конец которого дописываются данные
+        virtual void saveSession(std::string &out) const
+        {
+            // 0 - состояние не задано, иначе порядковый номер + 1
+            std::uint64_t index = 0;
             if (m_cur_state)
             {
-                std::cout << "Updating state: " << m_cur_state->getName()
-                          << "\n";
-                handleLibEvents(m_cur_state->update(params));
+                auto it = m_states.find(m_cur_state->getName());
+                index = std::distance(m_states.begin(), it) + 1;
             }
-            else
-                std::cout << "Текущее состояние не задано!\n";
-            return Events::Base<CustomEvents>(Events::Type::None);
+            Encoding::writeVarint(out, index);
+
+            Encoding::writeVarint(out, m_context.size());
+            m_context.forEach(
+                [&out](const std::string &key, const std::string &value) {
+                    Encoding::writeVarint(out, key.size());
+                    out += key;
+                    Encoding::writeVarint(out, value.size());
+                    out += value;
+                });
         }
+
+        /// @brief Восстановить сессию, сохраненную saveSession(). Сценарий
+        /// должен быть уже инициализирован через init().
+        /// @param data Сохраненные данные
+        /// @param pos Позиция чтения, сдвигается на прочитанные байты
+        /// @return Удалось ли восстановить сессию
+        virtual bool loadSession(const std::string &data, std::size_t &pos)
+        {
+            auto readString = [&data, &pos](std::string &out) {
+                std::uint64_t len = 0;
+                if (!Encoding::readVarint(data, pos, len) ||
+                    len > data.size() - pos)
+                    return false;
+                out.assign(data, pos, len);
+                pos += len;
+                return true;
+            };
+
+            std::uint64_t index = 0, count = 0;
+            Context context;
+            bool ok = Encoding::readVarint(data, pos, index) &&
+                      index <= m_states.size() &&
+                      Encoding::readVarint(data, pos, count);
+            for (std::uint64_t i = 0; ok && i < count; ++i)
+            {
+                std::string key, value;
+                ok = readString(key) && readString(value);
+                if (ok)
+                    context = context.set(std::move(key), std::move(value));
+            }
+            if (!ok)
+            {
+                SM_LOG("Cannot load session: bad data\n");
+                return false;
+            }
+
+            m_cur_state = nullptr;
+            if (index > 0)
+                m_cur_state = std::next(m_states.begin(), index - 1)
+                                  ->second.get();
+            m_context = std::move(context);
+            m_finished = false;
+            return true;
+        }
+
     };
 } // namespace SM
 
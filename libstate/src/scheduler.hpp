@@ -0,0 +1,631 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include "libstate.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <queue>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+// Пространство имен библиотеки состояний
+namespace SM
+{
+    // Идентификатор арендатора (группы сессий с общей квотой)
+    using TenantId = std::uint32_t;
+
+    // Планировщик обработки сессий в пуле потоков (уровень под
+    // Scenario Manager). Каждая сессия имеет очередь входящих
+    // сообщений. Сессия с сообщениями попадает в очередь готовых
+    // сессий своего потока, порядок определяется политикой. Свободный
+    // поток забирает работу у соседей. Одна сессия никогда не
+    // обрабатывается двумя потоками одновременно.
+    template <typename ScenarioT>
+    class Scheduler
+    {
+      public:
+        using Event = typename ScenarioT::Event;
+        using Clock = std::chrono::steady_clock;
+
+        // Порядок выбора готовых сессий
+        enum class Policy
+        {
+            Fifo,             // В порядке поступления
+            WeightedFair,     // Взвешенно-справедливо между арендаторами
+            EarliestDeadline, // Сначала ближайший дедлайн сообщения
+        };
+
+        struct Options
+        {
+            std::size_t m_workers = 4;
+            Policy m_policy = Policy::WeightedFair;
+            // Сколько сообщений сессии обработать подряд, прежде чем
+            // вернуть ее в очередь (0 - всю очередь сессии)
+            std::size_t m_batch = 1;
+            bool m_work_stealing = true;
+            // Дедлайн сообщения по умолчанию
+            Clock::duration m_default_deadline =
+                std::chrono::milliseconds(100);
+        };
+
+        // Настройки арендатора
+        struct Tenant
+        {
+            // Доля ресурсов относительно других арендаторов
+            double m_weight = 1.0;
+            // Максимум необработанных сообщений (0 - без ограничения)
+            std::size_t m_quota = 0;
+        };
+
+        // Результат обработки одного сообщения
+        struct Completion
+        {
+            SessionId m_session;
+            TenantId m_tenant;
+            Event m_event;
+            // От submit() до конца update()
+            std::uint64_t m_latency_ns;
+        };
+
+        struct Stats
+        {
+            std::uint64_t m_processed = 0;
+            std::uint64_t m_rejected = 0; // Отказано по квоте
+            std::uint64_t m_stolen = 0;   // Забрано у другого потока
+            // Отложено после просроченного дедлайна (EarliestDeadline)
+            std::uint64_t m_overdue = 0;
+            // Удалено завершившихся сессий и отброшено их сообщений
+            std::uint64_t m_reclaimed = 0;
+            std::uint64_t m_dropped = 0;
+        };
+
+        using Callback = std::function<void(const Completion &)>;
+
+        /// @param options Параметры планировщика
+        /// @param callback Вызывается из рабочего потока после каждого
+        /// обработанного сообщения
+        Scheduler(Options options, Callback callback = {})
+            : m_options(options)
+            , m_callback(std::move(callback))
+            , m_workers(std::max<std::size_t>(options.m_workers, 1))
+        {
+        }
+
+        ~Scheduler()
+        {
+            stop();
+        }
+
+        /// @brief Задать настройки арендатора (до первых submit())
+        void setTenant(TenantId id, const Tenant &tenant)
+        {
+            std::lock_guard<std::mutex> lock(m_tenants_mutex);
+            m_tenants[id].m_config = tenant;
+        }
+
+        /// @brief Зарегистрировать сессию. Сценарий должен быть
+        /// инициализирован.
+        /// @return false, если сессия с таким id уже есть
+        bool addSession(SessionId id, TenantId tenant,
+                        std::unique_ptr<ScenarioT> scenario)
+        {
+            std::unique_lock<std::shared_mutex> lock(m_sessions_mutex);
+            if (m_sessions.count(id))
+            {
+                SM_LOG("Session already exists: " << id << "\n");
+                return false;
+            }
+            auto session = std::make_unique<Session>();
+            session->m_id = id;
+            session->m_tenant = tenantState(tenant);
+            session->m_tenant_id = tenant;
+            session->m_scenario = std::move(scenario);
+            session->m_home = id % m_workers.size();
+            m_sessions[id] = std::move(session);
+            return true;
+        }
+
+        /// @brief Поставить сообщение в очередь сессии
+        /// @param id Идентификатор сессии
+        /// @param params Данные для Scenario::update
+        /// @param deadline Желаемое время обработки от текущего момента
+        /// (по умолчанию Options::m_default_deadline)
+        /// @return false, если сессия неизвестна (в том числе уже
+        /// завершилась и удалена) или превышена квота
+        bool submit(SessionId id, outsideParams params,
+                    std::optional<Clock::duration> deadline = std::nullopt)
+        {
+            // Пока сообщение ставится, сессию нельзя удалить
+            std::shared_lock<std::shared_mutex> sessions(m_sessions_mutex);
+            auto it = m_sessions.find(id);
+            if (it == m_sessions.end())
+                return false;
+            Session *session = it->second.get();
+            std::lock_guard<std::mutex> lock(session->m_mutex);
+            if (session->m_finished)
+                return false;
+
+            TenantState &tenant = *session->m_tenant;
+            if (tenant.m_config.m_quota &&
+                tenant.m_queued.fetch_add(1) >= tenant.m_config.m_quota)
+            {
+                tenant.m_queued.fetch_sub(1);
+                m_rejected.fetch_add(1);
+                return false;
+            }
+            if (!tenant.m_config.m_quota)
+                tenant.m_queued.fetch_add(1);
+            m_inflight.fetch_add(1);
+
+            auto now = Clock::now();
+            session->m_mailbox.push_back(Message{
+                std::move(params), now,
+                now + deadline.value_or(m_options.m_default_deadline)});
+            if (!session->m_scheduled)
+            {
+                session->m_scheduled = true;
+                makeRunnable(*session, session->m_home);
+            }
+            return true;
+        }
+
+        /// @brief Запустить рабочие потоки
+        void start()
+        {
+            if (!m_threads.empty())
+                return;
+            m_stop = false;
+            for (std::size_t i = 0; i < m_workers.size(); ++i)
+                m_threads.emplace_back([this, i] { workerLoop(i); });
+        }
+
+        /// @brief Остановить рабочие потоки (необработанные сообщения
+        /// остаются в очередях)
+        void stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_wake_mutex);
+                m_stop = true;
+            }
+            m_wake_cv.notify_all();
+            for (auto &worker : m_workers)
+                worker.m_wake_cv.notify_all();
+            for (auto &thread : m_threads)
+                thread.join();
+            m_threads.clear();
+        }
+
+        /// @brief Дождаться обработки всех поставленных сообщений
+        void drain()
+        {
+            std::unique_lock<std::mutex> lock(m_wake_mutex);
+            m_idle_cv.wait(lock, [this] { return m_inflight == 0; });
+        }
+
+        Stats stats() const
+        {
+            return Stats{m_processed.load(), m_rejected.load(),
+                         m_stolen.load(), m_overdue.load(),
+                         m_reclaimed.load(), m_dropped.load()};
+        }
+
+      private:
+        struct Message
+        {
+            outsideParams m_params;
+            Clock::time_point m_enqueued;
+            Clock::time_point m_deadline;
+        };
+
+        struct TenantState
+        {
+            Tenant m_config;
+            std::atomic<std::size_t> m_queued{0};
+        };
+
+        struct Session
+        {
+            SessionId m_id = 0;
+            TenantId m_tenant_id = 0;
+            TenantState *m_tenant = nullptr;
+            std::unique_ptr<ScenarioT> m_scenario;
+            std::size_t m_home = 0;
+
+            std::mutex m_mutex;
+            std::deque<Message> m_mailbox;
+            // Сессия стоит в очереди готовых или обрабатывается
+            bool m_scheduled = false;
+            // Сценарий завершился, сессия удаляется
+            bool m_finished = false;
+        };
+
+        // Элемент очереди готовых сессий: меньший ключ - раньше
+        struct Entry
+        {
+            double m_key;
+            std::uint64_t m_seq;
+            Session *m_session;
+            // Ключ уже заменен после просроченного дедлайна
+            bool m_overdue = false;
+
+            bool operator>(const Entry &other) const
+            {
+                return m_key != other.m_key ? m_key > other.m_key
+                                            : m_seq > other.m_seq;
+            }
+        };
+
+        // Готовые сессии одного арендатора в потоке (WeightedFair)
+        struct Lane
+        {
+            // Сколько сообщений арендатор получает за круг
+            double m_quantum = 1.0;
+            // Остаток текущего круга. Пачка из нескольких сообщений
+            // уводит его в минус, долг переносится на следующие круги.
+            double m_deficit = 0;
+            bool m_active = false;
+            std::deque<Session *> m_sessions;
+        };
+
+        struct Worker
+        {
+            std::mutex m_mutex;
+            // Fifo и EarliestDeadline
+            std::priority_queue<Entry, std::vector<Entry>,
+                                std::greater<Entry>>
+                m_ready;
+            // WeightedFair: очереди арендаторов и круг непустых очередей
+            // (deficit round robin)
+            std::unordered_map<TenantState *, Lane> m_lanes;
+            std::deque<Lane *> m_round;
+            // Без кражи работы поток ждет только свою очередь: у него
+            // свой счетчик готовых сессий и свое условие пробуждения
+            // (оба под m_wake_mutex)
+            std::size_t m_runnable = 0;
+            std::condition_variable m_wake_cv;
+        };
+
+        TenantState *tenantState(TenantId id)
+        {
+            std::lock_guard<std::mutex> lock(m_tenants_mutex);
+            return &m_tenants[id];
+        }
+
+        // Нижняя граница кванта арендатора с нулевым весом
+        static constexpr double kMinQuantum = 1e-3;
+
+        static double seconds(Clock::time_point time)
+        {
+            return std::chrono::duration<double>(time.time_since_epoch())
+                .count();
+        }
+
+        /// @brief Ключ сессии в очереди готовых (Fifo, EarliestDeadline).
+        /// Вызывается под мьютексом сессии, очередь сессии не пуста.
+        double priorityKey(Session &session, std::uint64_t seq)
+        {
+            if (m_options.m_policy == Policy::EarliestDeadline)
+                return seconds(session.m_mailbox.front().m_deadline);
+            return double(seq);
+        }
+
+        /// @brief Поставить сессию в очередь готовых потока
+        void makeRunnable(Session &session, std::size_t index)
+        {
+            Worker &worker = m_workers[index];
+            {
+                // Очередь и счетчики меняются под одной блокировкой:
+                // сессию нельзя забрать раньше, чем она учтена
+                std::scoped_lock lock(m_wake_mutex, worker.m_mutex);
+                if (m_options.m_policy == Policy::WeightedFair)
+                    pushLane(worker, session);
+                else
+                {
+                    std::uint64_t seq = m_seq.fetch_add(1);
+                    worker.m_ready.push(
+                        Entry{priorityKey(session, seq), seq, &session});
+                }
+                ++m_runnable;
+                ++worker.m_runnable;
+            }
+            if (m_options.m_work_stealing)
+                m_wake_cv.notify_one();
+            else
+                worker.m_wake_cv.notify_one();
+        }
+
+        /// @brief Поставить сессию в очередь ее арендатора. Вызывается
+        /// под мьютексом потока.
+        void pushLane(Worker &worker, Session &session)
+        {
+            auto [it, created] = worker.m_lanes.try_emplace(session.m_tenant);
+            Lane &lane = it->second;
+            if (created)
+                lane.m_quantum = std::max(
+                    session.m_tenant->m_config.m_weight, kMinQuantum);
+            lane.m_sessions.push_back(&session);
+            if (!lane.m_active)
+            {
+                lane.m_active = true;
+                worker.m_round.push_back(&lane);
+            }
+        }
+
+        /// @brief Взять сессию арендатора, чей ход в круге. Каждое
+        /// сообщение стоит 1, за ход арендатор получает свой квант.
+        /// Вызывается под мьютексом потока.
+        Session *popLane(Worker &worker)
+        {
+            while (!worker.m_round.empty())
+            {
+                Lane &lane = *worker.m_round.front();
+                if (lane.m_deficit <= 0)
+                {
+                    // Начало хода арендатора
+                    lane.m_deficit += lane.m_quantum;
+                    if (lane.m_deficit <= 0)
+                    {
+                        endTurn(worker);
+                        continue;
+                    }
+                }
+
+                Session *session = lane.m_sessions.front();
+                lane.m_sessions.pop_front();
+                lane.m_deficit -= 1;
+                if (lane.m_sessions.empty())
+                {
+                    // Пустая очередь не копит квант, долг сохраняется
+                    lane.m_active = false;
+                    lane.m_deficit = std::min(lane.m_deficit, 0.0);
+                    worker.m_round.pop_front();
+                }
+                else if (lane.m_deficit <= 0)
+                    endTurn(worker);
+                return session;
+            }
+            return nullptr;
+        }
+
+        static void endTurn(Worker &worker)
+        {
+            worker.m_round.push_back(worker.m_round.front());
+            worker.m_round.pop_front();
+        }
+
+        /// @brief Списать с арендатора сообщения пачки сверх одного,
+        /// списанного при выборе сессии (WeightedFair)
+        void charge(Worker &worker, TenantState *tenant, std::size_t done)
+        {
+            if (done == 1)
+                return;
+            std::lock_guard<std::mutex> lock(worker.m_mutex);
+            Lane &lane = worker.m_lanes[tenant];
+            lane.m_deficit -= double(done) - 1;
+            if (lane.m_active && lane.m_deficit <= 0 &&
+                worker.m_round.front() == &lane)
+                endTurn(worker);
+        }
+
+        /// @brief Взять сессию с наименьшим ключом. В EarliestDeadline
+        /// сессия с просроченным дедлайном один раз получает новый
+        /// дедлайн по умолчанию от текущего момента: при перегрузке она
+        /// не задерживает сообщения, которые еще можно успеть
+        /// обработать, но и не ждет бесконечно. Вызывается под
+        /// мьютексом потока.
+        Session *popReady(Worker &worker)
+        {
+            auto &ready = worker.m_ready;
+            if (m_options.m_policy == Policy::EarliestDeadline)
+            {
+                auto now = Clock::now();
+                double demoted =
+                    seconds(now + m_options.m_default_deadline);
+                while (!ready.empty() && !ready.top().m_overdue &&
+                       ready.top().m_key < seconds(now))
+                {
+                    Entry entry = ready.top();
+                    ready.pop();
+                    entry.m_key = demoted;
+                    entry.m_overdue = true;
+                    ready.push(entry);
+                    m_overdue.fetch_add(1);
+                }
+            }
+            if (ready.empty())
+                return nullptr;
+            Session *session = ready.top().m_session;
+            ready.pop();
+            return session;
+        }
+
+        /// @brief Взять готовую сессию: свою или (если разрешено) чужую
+        /// @param from Поток, из очереди которого взята сессия
+        Session *takeSession(std::size_t index, std::size_t &from)
+        {
+            auto take = [this](Worker &worker) -> Session * {
+                Session *session;
+                {
+                    std::lock_guard<std::mutex> lock(worker.m_mutex);
+                    session = m_options.m_policy == Policy::WeightedFair
+                                  ? popLane(worker)
+                                  : popReady(worker);
+                    if (!session)
+                        return nullptr;
+                }
+                std::lock_guard<std::mutex> lock(m_wake_mutex);
+                --m_runnable;
+                --worker.m_runnable;
+                return session;
+            };
+
+            from = index;
+            Session *session = take(m_workers[index]);
+            if (!session && m_options.m_work_stealing)
+                for (std::size_t i = 1; i < m_workers.size() && !session;
+                     ++i)
+                {
+                    from = (index + i) % m_workers.size();
+                    session = take(m_workers[from]);
+                    if (session)
+                        m_stolen.fetch_add(1);
+                }
+            return session;
+        }
+
+        void workerLoop(std::size_t index)
+        {
+            while (true)
+            {
+                std::size_t from;
+                Session *session = takeSession(index, from);
+                if (!session)
+                {
+                    std::unique_lock<std::mutex> lock(m_wake_mutex);
+                    Worker &worker = m_workers[index];
+                    if (m_options.m_work_stealing)
+                        m_wake_cv.wait(lock, [this] {
+                            return m_stop || m_runnable > 0;
+                        });
+                    else
+                        worker.m_wake_cv.wait(lock, [this, &worker] {
+                            return m_stop || worker.m_runnable > 0;
+                        });
+                    if (m_stop)
+                        return;
+                    continue;
+                }
+
+                // Завершившаяся сессия удаляется внутри runSession()
+                TenantState *tenant = session->m_tenant;
+                std::size_t done = runSession(*session, index);
+                if (m_options.m_policy == Policy::WeightedFair)
+                    charge(m_workers[from], tenant, done);
+            }
+        }
+
+        /// @brief Обработать пачку сообщений сессии и вернуть ее в
+        /// очередь, если сообщения остались. Завершившаяся сессия
+        /// (Scenario::isFinished) удаляется.
+        /// @return Сколько сообщений обработано
+        std::size_t runSession(Session &session, std::size_t worker)
+        {
+            std::size_t done = 0;
+            while (true)
+            {
+                Message message;
+                {
+                    std::lock_guard<std::mutex> lock(session.m_mutex);
+                    if (session.m_mailbox.empty())
+                    {
+                        session.m_scheduled = false;
+                        return done;
+                    }
+                    if (m_options.m_batch && done == m_options.m_batch)
+                    {
+                        // Сессия остается у потока, который ее обработал
+                        makeRunnable(session, worker);
+                        return done;
+                    }
+                    message = std::move(session.m_mailbox.front());
+                    session.m_mailbox.pop_front();
+                }
+
+                Event event = session.m_scenario->update(message.m_params);
+                ++done;
+                session.m_tenant->m_queued.fetch_sub(1);
+                m_processed.fetch_add(1);
+                if (m_callback)
+                    m_callback(Completion{
+                        session.m_id, session.m_tenant_id, std::move(event),
+                        std::uint64_t(std::chrono::duration_cast<
+                                          std::chrono::nanoseconds>(
+                                          Clock::now() - message.m_enqueued)
+                                          .count())});
+
+                if (session.m_scenario->isFinished())
+                {
+                    reclaim(session);
+                    return done;
+                }
+                finishMessages(1);
+            }
+        }
+
+        /// @brief Удалить завершившуюся сессию. Ее необработанные
+        /// сообщения отбрасываются, новые submit() отклоняются.
+        /// Последнее обработанное сообщение учитывается после удаления:
+        /// drain() не вернется раньше.
+        void reclaim(Session &session)
+        {
+            std::size_t dropped;
+            {
+                std::lock_guard<std::mutex> lock(session.m_mutex);
+                session.m_finished = true;
+                session.m_scheduled = false;
+                dropped = session.m_mailbox.size();
+                session.m_mailbox.clear();
+            }
+            session.m_tenant->m_queued.fetch_sub(dropped);
+            m_dropped.fetch_add(dropped);
+
+            // submit() держит m_sessions_mutex на чтение до конца
+            // постановки, поэтому после захвата на запись ссылок на
+            // сессию больше нет
+            SessionId id = session.m_id;
+            {
+                std::unique_lock<std::shared_mutex> lock(m_sessions_mutex);
+                m_sessions.erase(id);
+            }
+            m_reclaimed.fetch_add(1);
+            finishMessages(dropped + 1);
+        }
+
+        /// @brief Учесть обработанные или отброшенные сообщения и
+        /// разбудить drain(), когда их не осталось
+        void finishMessages(std::size_t count)
+        {
+            if (count && m_inflight.fetch_sub(count) == count)
+            {
+                std::lock_guard<std::mutex> lock(m_wake_mutex);
+                m_idle_cv.notify_all();
+            }
+        }
+
+        Options m_options;
+        Callback m_callback;
+
+        std::vector<Worker> m_workers;
+        std::vector<std::thread> m_threads;
+
+        std::shared_mutex m_sessions_mutex;
+        std::unordered_map<SessionId, std::unique_ptr<Session>> m_sessions;
+
+        // std::map: адреса TenantState не меняются при вставке
+        std::mutex m_tenants_mutex;
+        std::map<TenantId, TenantState> m_tenants;
+
+        std::mutex m_wake_mutex;
+        std::condition_variable m_wake_cv;
+        std::condition_variable m_idle_cv;
+        // Готовых сессий во всех очередях
+        std::size_t m_runnable = 0;
+        bool m_stop = false;
+
+        std::atomic<std::uint64_t> m_seq{0};
+        std::atomic<std::size_t> m_inflight{0};
+        std::atomic<std::uint64_t> m_processed{0};
+        std::atomic<std::uint64_t> m_rejected{0};
+        std::atomic<std::uint64_t> m_stolen{0};
+        std::atomic<std::uint64_t> m_overdue{0};
+        std::atomic<std::uint64_t> m_reclaimed{0};
+        std::atomic<std::uint64_t> m_dropped{0};
+    };
+} // namespace SM
+
+#endif // !SCHEDULER_HPP
@@ -0,0 +1,387 @@
+#ifndef SESSIONPOOL_HPP
+#define SESSIONPOOL_HPP
+
+#include "libstate.hpp"
+
+#include <cstring>
+
+// Пространство имен библиотеки состояний
+namespace SM
+{
+    // Компактная запись сессии. Состояния, переходы и прочее описание
+    // сценария хранятся один раз в общем описании, у сессии остается
+    // только положение в нем.
+    struct SessionRecord
+    {
+        static constexpr std::size_t kInlineContext = 15;
+        // m_context_size у свободной записи
+        static constexpr std::uint8_t kFree = 0xff;
+
+        std::uint16_t m_state;      // State::getId() или kNoState
+        std::uint16_t m_definition; // Номер описания в SessionPool
+        std::uint32_t m_generation; // Растет при каждом освобождении
+        std::uint8_t m_context_size;
+        // Пользовательский контекст; у свободной записи здесь лежит
+        // номер следующей свободной записи
+        char m_context[kInlineContext];
+    };
+    static_assert(sizeof(SessionRecord) == 24,
+                  "SessionRecord must stay compact");
+
+    // Ссылка на сессию в SessionPool. Поколение защищает от обращения
+    // к уже освобожденной и переиспользованной записи.
+    struct SessionHandle
+    {
+        std::uint32_t m_index = 0;
+        std::uint32_t m_generation = 0;
+    };
+
+    // Отчет о расходе памяти на сессии
+    struct MemoryReport
+    {
+        std::size_t m_record_bytes = sizeof(SessionRecord);
+        std::size_t m_live = 0;       // Живых сессий
+        std::size_t m_capacity = 0;   // Записей во всех слэбах
+        std::size_t m_slabs = 0;
+        std::size_t m_slab_bytes = 0; // Память под слэбы и их учет
+        // Сессии с непустым контекстом сценария и оценка памяти под
+        // эти контексты
+        std::size_t m_context_sessions = 0;
+        std::size_t m_context_bytes = 0;
+        // Память слэбов и контекстов на одну живую сессию
+        double m_bytes_per_session = 0;
+        // Доля занятых записей
+        double m_utilisation = 0;
+        // Доля свободных записей в слэбах, где есть живые сессии: эту
+        // память нельзя вернуть, пока сессии не освободятся
+        double m_fragmentation = 0;
+
+        void print(std::ostream &out) const
+        {
+            out << "record bytes:      " << m_record_bytes << "\n"
+                << "live sessions:     " << m_live << "\n"
+                << "capacity:          " << m_capacity << " in "
+                << m_slabs << " slabs (" << m_slab_bytes << " bytes)\n"
+                << "contexts:          " << m_context_sessions << " ("
+                << m_context_bytes << " bytes)\n"
+                << "bytes per session: " << m_bytes_per_session << "\n"
+                << "utilisation:       " << m_utilisation << "\n"
+                << "fragmentation:     " << m_fragmentation << "\n";
+        }
+    };
+
+    // Пул компактных сессий. Сессии хранятся записями SessionRecord в
+    // слэбах фиксированного размера, освобожденные записи уходят в
+    // список свободных и переиспользуются. Обработка update() идет
+    // через общее скомпилированное описание сценария (Scenario после
+    // freeze()), в которое на время вызова подставляется состояние
+    // сессии. Контекст сценария (Scenario::getContext) сохраняется
+    // между вызовами в отдельной таблице, только у сессий, где он не
+    // пуст. Пользовательский контекст записи - это отдельные данные
+    // владельца пула. Пул не потокобезопасен.
+    template <typename ScenarioT>
+    class SessionPool
+    {
+      public:
+        using Event = typename ScenarioT::Event;
+
+        // Записей в одном слэбе (24 байта * 4096 = 96 КБ)
+        static constexpr std::size_t kSlabRecords = 4096;
+
+        // Результат addDefinition() для описания, которое не удалось
+        // скомпилировать
+        static constexpr std::uint16_t kNoDefinition = 0xffff;
+
+        /// @brief Добавить описание сценария. Описание инициализируется
+        /// и компилируется, если это еще не сделано.
+        /// @return Номер описания для create() или kNoDefinition, если
+        /// freeze() не удался
+        std::uint16_t addDefinition(std::unique_ptr<ScenarioT> definition,
+                                    bool initialized = false)
+        {
+            if (!initialized)
+                definition->init({});
+            if (!definition->isFrozen() && !definition->freeze())
+            {
+                SM_LOG("Cannot add definition: freeze failed\n");
+                return kNoDefinition;
+            }
+            if (m_definitions.size() >= kNoDefinition)
+            {
+                SM_LOG("Cannot add definition: too many\n");
+                return kNoDefinition;
+            }
+            m_definitions.push_back(std::move(definition));
+            return m_definitions.size() - 1;
+        }
+
+        /// @brief Получить описание сценария (например, для профиля).
+        /// Менять описание можно только через методы пула: номера
+        /// состояний в записях сессий привязаны к его таблице.
+        const ScenarioT &definition(std::uint16_t index) const
+        {
+            return *m_definitions[index];
+        }
+
+        /// @brief Включить подсчет частот переходов описания (см.
+        /// Scenario::setProfiling)
+        /// @return false, если описание неизвестно
+        bool setProfiling(std::uint16_t definition, bool enabled)
+        {
+            if (definition >= m_definitions.size())
+                return false;
+            m_definitions[definition]->setProfiling(enabled);
+            return true;
+        }
+
+        /// @brief Перекомпилировать описание, например по собранному
+        /// профилю. Живые сессии описания получают новые номера своих
+        /// состояний по именам состояний.
+        /// @param profile Частоты переходов (nullptr - порядок по именам)
+        /// @return false, если описание неизвестно или freeze() не удался
+        bool relayout(std::uint16_t definition,
+                      const typename ScenarioT::Profile *profile)
+        {
+            if (definition >= m_definitions.size())
+                return false;
+            ScenarioT &scenario = *m_definitions[definition];
+            std::vector<std::string> names;
+            for (std::uint16_t id = 0; id < scenario.getStateCount(); ++id)
+                names.push_back(scenario.getStateName(id));
+            if (!scenario.freeze(profile))
+            {
+                SM_LOG("Cannot relayout definition: freeze failed\n");
+                return false;
+            }
+
+            std::vector<std::uint16_t> ids;
+            for (const auto &name : names)
+                ids.push_back(scenario.getStateId(name));
+            for (std::uint32_t index = 0;
+                 index < m_slabs.size() * kSlabRecords; ++index)
+            {
+                SessionRecord &rec = record(index);
+                if (rec.m_context_size != SessionRecord::kFree &&
+                    rec.m_definition == definition &&
+                    rec.m_state < ids.size())
+                    rec.m_state = ids[rec.m_state];
+            }
+            return true;
+        }
+
+        /// @brief Создать сессию в стартовом состоянии описания
+        /// @return Ссылка на сессию; для неизвестного описания ссылка
+        /// сразу невалидна
+        SessionHandle create(std::uint16_t definition)
+        {
+            if (definition >= m_definitions.size())
+            {
+                SM_LOG("Unknown definition: " << definition << "\n");
+                return SessionHandle{kNoFree, 0};
+            }
+            if (m_free == kNoFree)
+                addSlab();
+            std::uint32_t index = m_free;
+            SessionRecord &rec = record(index);
+            std::memcpy(&m_free, rec.m_context, sizeof(m_free));
+
+            rec.m_state = m_definitions[definition]->getStartStateId();
+            rec.m_definition = definition;
+            rec.m_context_size = 0;
+            ++m_slab_live[index / kSlabRecords];
+            ++m_live;
+            return SessionHandle{index, rec.m_generation};
+        }
+
+        /// @brief Освободить сессию
+        /// @return false, если ссылка устарела
+        bool release(SessionHandle handle)
+        {
+            if (!valid(handle))
+                return false;
+            SessionRecord &rec = record(handle.m_index);
+            m_contexts.erase(handle.m_index);
+            ++rec.m_generation;
+            rec.m_context_size = SessionRecord::kFree;
+            std::memcpy(rec.m_context, &m_free, sizeof(m_free));
+            m_free = handle.m_index;
+            --m_slab_live[handle.m_index / kSlabRecords];
+            --m_live;
+            return true;
+        }
+
+        /// @brief Указывает ли ссылка на живую сессию
+        bool valid(SessionHandle handle) const
+        {
+            if (handle.m_index >= m_slabs.size() * kSlabRecords)
+                return false;
+            const SessionRecord &rec = record(handle.m_index);
+            return rec.m_context_size != SessionRecord::kFree &&
+                   rec.m_generation == handle.m_generation;
+        }
+
+        /// @brief Передать данные в сессию
+        /// @return Событие сценария или None для устаревшей ссылки.
+        /// Завершившаяся сессия (Scenario::isFinished) сразу
+        /// освобождается, ее ссылка становится устаревшей.
+        Event update(SessionHandle handle, const outsideParams &params)
+        {
+            if (!valid(handle))
+            {
+                SM_LOG("Stale session handle: " << handle.m_index << "\n");
+                return Event(Events::Type::None);
+            }
+            SessionRecord &rec = record(handle.m_index);
+            ScenarioT &definition = *m_definitions[rec.m_definition];
+            auto context = m_contexts.find(handle.m_index);
+            if (!definition.setCurrentStateId(
+                    rec.m_state, context != m_contexts.end()
+                                     ? context->second
+                                     : Context()))
+            {
+                SM_LOG("Cannot restore session state: "
+                       << handle.m_index << "\n");
+                return Event(Events::Type::None);
+            }
+            Event event = definition.update(params);
+            rec.m_state = definition.getCurrentStateId();
+            if (!definition.getContext().empty())
+                m_contexts.insert_or_assign(handle.m_index,
+                                            definition.getContext());
+            else if (context != m_contexts.end())
+                m_contexts.erase(context);
+            if (definition.isFinished())
+                release(handle);
+            return event;
+        }
+
+        /// @brief Номер текущего состояния сессии (State::getId())
+        std::uint16_t stateId(SessionHandle handle) const
+        {
+            return valid(handle) ? record(handle.m_index).m_state
+                                 : ScenarioT::kNoState;
+        }
+
+        /// @brief Записать пользовательский контекст сессии
+        /// @return false, если ссылка устарела или данные не помещаются
+        /// в SessionRecord::kInlineContext байт
+        bool setUserContext(SessionHandle handle, std::string_view data)
+        {
+            if (!valid(handle) ||
+                data.size() > SessionRecord::kInlineContext)
+                return false;
+            SessionRecord &rec = record(handle.m_index);
+            std::memcpy(rec.m_context, data.data(), data.size());
+            rec.m_context_size = data.size();
+            return true;
+        }
+
+        /// @brief Прочитать пользовательский контекст сессии
+        std::string_view userContext(SessionHandle handle) const
+        {
+            if (!valid(handle))
+                return {};
+            const SessionRecord &rec = record(handle.m_index);
+            return std::string_view(rec.m_context, rec.m_context_size);
+        }
+
+        std::size_t size() const
+        {
+            return m_live;
+        }
+
+        /// @brief Отчет о расходе памяти на сессии
+        MemoryReport memoryReport() const
+        {
+            MemoryReport report;
+            report.m_live = m_live;
+            report.m_slabs = m_slabs.size();
+            report.m_capacity = m_slabs.size() * kSlabRecords;
+            report.m_slab_bytes =
+                report.m_capacity * sizeof(SessionRecord) +
+                m_slabs.capacity() * sizeof(m_slabs[0]) +
+                m_slab_live.capacity() * sizeof(m_slab_live[0]);
+            report.m_context_sessions = m_contexts.size();
+            report.m_context_bytes =
+                m_contexts.bucket_count() * sizeof(void *);
+            for (const auto &[index, context] : m_contexts)
+            {
+                // Узел таблицы и по записи treap на ключ; записи
+                // разных версий одной сессии могут быть общими, поэтому
+                // это оценка сверху
+                report.m_context_bytes += kContextNodeBytes;
+                context.forEach([&report](const std::string &key,
+                                          const std::string &value) {
+                    report.m_context_bytes += kContextEntryBytes +
+                                              key.capacity() +
+                                              value.capacity();
+                });
+            }
+            if (m_live)
+                report.m_bytes_per_session =
+                    double(report.m_slab_bytes + report.m_context_bytes) /
+                    m_live;
+            if (report.m_capacity)
+            {
+                report.m_utilisation = double(m_live) / report.m_capacity;
+                std::size_t pinned = 0;
+                for (auto live : m_slab_live)
+                    if (live)
+                        pinned += kSlabRecords - live;
+                report.m_fragmentation = double(pinned) / report.m_capacity;
+            }
+            return report;
+        }
+
+      private:
+        static constexpr std::uint32_t kNoFree = 0xffffffff;
+        // Приблизительные размеры для MemoryReport. Узел
+        // unordered_map: пара, указатель на следующий и кэш хеша.
+        static constexpr std::size_t kContextNodeBytes =
+            sizeof(std::pair<const std::uint32_t, Context>) +
+            2 * sizeof(void *);
+        // Запись Context: узел treap (три shared_ptr и приоритет), пара
+        // строк и два блока счетчиков make_shared
+        static constexpr std::size_t kContextEntryBytes =
+            7 * sizeof(void *) + 2 * sizeof(std::string) +
+            2 * 2 * sizeof(long);
+
+        SessionRecord &record(std::uint32_t index)
+        {
+            return m_slabs[index / kSlabRecords][index % kSlabRecords];
+        }
+
+        const SessionRecord &record(std::uint32_t index) const
+        {
+            return m_slabs[index / kSlabRecords][index % kSlabRecords];
+        }
+
+        /// @brief Выделить новый слэб и добавить его записи в список
+        /// свободных (по возрастанию номеров)
+        void addSlab()
+        {
+            std::uint32_t base = m_slabs.size() * kSlabRecords;
+            auto slab = std::make_unique<SessionRecord[]>(kSlabRecords);
+            for (std::size_t i = kSlabRecords; i-- > 0;)
+            {
+                SessionRecord &rec = slab[i];
+                rec.m_generation = 0;
+                rec.m_context_size = SessionRecord::kFree;
+                std::memcpy(rec.m_context, &m_free, sizeof(m_free));
+                m_free = base + i;
+            }
+            m_slabs.push_back(std::move(slab));
+            m_slab_live.push_back(0);
+        }
+
+        std::vector<std::unique_ptr<ScenarioT>> m_definitions;
+        std::vector<std::unique_ptr<SessionRecord[]>> m_slabs;
+        std::vector<std::uint32_t> m_slab_live;
+        std::uint32_t m_free = kNoFree;
+        std::size_t m_live = 0;
+        // Контексты сценария по номеру записи, только непустые
+        std::unordered_map<std::uint32_t, Context> m_contexts;
+    };
+} // namespace SM
+
+#endif // !SESSIONPOOL_HPP
@@ -0,0 +1,469 @@
+#ifndef SESSIONSTORE_HPP
+#define SESSIONSTORE_HPP
+
+#include "libstate.hpp"
+
+#include <chrono>
+#include <fstream>
+
+// Пространство имен библиотеки состояний
+namespace SM
+{
+    // Холодное хранилище: сессии в сериализованном виде
+    class ColdStore
+    {
+      public:
+        virtual ~ColdStore()
+        {
+        }
+
+        /// @brief Положить сессию в хранилище (перезаписывает старую)
+        /// @param id Идентификатор сессии
+        /// @param data Сериализованная сессия
+        virtual void put(SessionId id, const std::string &data) = 0;
+
+        /// @brief Забрать сессию из хранилища (запись удаляется)
+        /// @param id Идентификатор сессии
+        /// @param data Сюда записываются данные сессии
+        /// @return Была ли сессия в хранилище
+        virtual bool take(SessionId id, std::string &data) = 0;
+
+        /// @brief Удалить сессию из хранилища
+        virtual void erase(SessionId id) = 0;
+
+        /// @brief Количество сессий в хранилище
+        virtual std::size_t size() const = 0;
+
+        /// @brief Объем данных живых сессий в байтах
+        virtual std::size_t bytes() const = 0;
+    };
+
+    // Холодное хранилище в памяти процесса
+    class MemoryColdStore : public ColdStore
+    {
+      public:
+        void put(SessionId id, const std::string &data) override
+        {
+            erase(id);
+            m_bytes += data.size();
+            m_records[id] = data;
+        }
+
+        bool take(SessionId id, std::string &data) override
+        {
+            auto it = m_records.find(id);
+            if (it == m_records.end())
+                return false;
+            m_bytes -= it->second.size();
+            data = std::move(it->second);
+            m_records.erase(it);
+            return true;
+        }
+
+        void erase(SessionId id) override
+        {
+            auto it = m_records.find(id);
+            if (it == m_records.end())
+                return;
+            m_bytes -= it->second.size();
+            m_records.erase(it);
+        }
+
+        std::size_t size() const override
+        {
+            return m_records.size();
+        }
+
+        std::size_t bytes() const override
+        {
+            return m_bytes;
+        }
+
+      private:
+        std::unordered_map<SessionId, std::string> m_records;
+        std::size_t m_bytes = 0;
+    };
+
+    // Холодное хранилище в локальном файле. Записи дописываются в конец
+    // файла, в памяти остается только индекс. Когда мертвых байт
+    // (удаленные и забранные записи) становится больше, чем живых,
+    // файл переписывается только с живыми записями, поэтому его размер
+    // не превышает примерно 2 * bytes() + kCompactMinBytes.
+    class FileColdStore : public ColdStore
+    {
+      public:
+        // Меньшие файлы не уплотняются
+        static constexpr std::size_t kCompactMinBytes = 1 << 20;
+
+        FileColdStore(const std::string &path)
+            : m_path(path)
+            , m_file(path, std::ios::in | std::ios::out |
+                               std::ios::binary | std::ios::trunc)
+        {
+            if (!m_file)
+                SM_LOG("Cannot open cold store file: " << path << "\n");
+        }
+
+        void put(SessionId id, const std::string &data) override
+        {
+            erase(id);
+            m_file.seekp(0, std::ios::end);
+            Record rec{static_cast<std::uint64_t>(m_file.tellp()),
+                       data.size()};
+            m_file.write(data.data(), data.size());
+            m_bytes += data.size();
+            m_file_bytes += data.size();
+            m_index[id] = rec;
+        }
+
+        bool take(SessionId id, std::string &data) override
+        {
+            auto it = m_index.find(id);
+            if (it == m_index.end())
+                return false;
+            data.resize(it->second.m_size);
+            m_file.seekg(it->second.m_offset);
+            m_file.read(data.data(), data.size());
+            bool ok = static_cast<bool>(m_file);
+            m_file.clear();
+            m_bytes -= it->second.m_size;
+            m_index.erase(it);
+            compactIfNeeded();
+            return ok;
+        }
+
+        void erase(SessionId id) override
+        {
+            auto it = m_index.find(id);
+            if (it == m_index.end())
+                return;
+            m_bytes -= it->second.m_size;
+            m_index.erase(it);
+            compactIfNeeded();
+        }
+
+        std::size_t size() const override
+        {
+            return m_index.size();
+        }
+
+        std::size_t bytes() const override
+        {
+            return m_bytes;
+        }
+
+        /// @brief Размер файла на диске вместе с мертвыми записями
+        std::size_t fileBytes() const
+        {
+            return m_file_bytes;
+        }
+
+      private:
+        /// @brief Переписать файл, оставив только живые записи
+        void compactIfNeeded()
+        {
+            if (m_file_bytes < kCompactMinBytes ||
+                m_file_bytes - m_bytes <= m_bytes)
+                return;
+
+            std::string live;
+            live.reserve(m_bytes);
+            for (auto &[id, rec] : m_index)
+            {
+                std::size_t offset = live.size();
+                live.resize(offset + rec.m_size);
+                m_file.seekg(rec.m_offset);
+                m_file.read(live.data() + offset, rec.m_size);
+                rec.m_offset = offset;
+            }
+            m_file.close();
+            m_file.open(m_path, std::ios::in | std::ios::out |
+                                    std::ios::binary | std::ios::trunc);
+            m_file.write(live.data(), live.size());
+            m_file_bytes = live.size();
+            if (!m_file)
+                SM_LOG("Cannot compact cold store file: " << m_path
+                       << "\n");
+        }
+
+        struct Record
+        {
+            std::uint64_t m_offset;
+            std::size_t m_size;
+        };
+
+        std::string m_path;
+        std::fstream m_file;
+        std::unordered_map<SessionId, Record> m_index;
+        std::size_t m_bytes = 0;
+        std::size_t m_file_bytes = 0;
+    };
+
+    // Таблица сессий с вытеснением простаивающих сессий в холодное
+    // хранилище. Горячие сессии хранятся целиком (объект сценария),
+    // холодные - только в виде Scenario::saveSession(). Вытесняется
+    // сессия, к которой дольше всех не обращались (LRU).
+    template <typename ScenarioT>
+    class SessionStore
+    {
+      public:
+        using Event = typename ScenarioT::Event;
+        using Factory = std::function<std::unique_ptr<ScenarioT>()>;
+
+        // Бюджеты памяти
+        struct Budget
+        {
+            // Максимум сессий в горячей таблице. Сессия, к которой
+            // обратились последней, не вытесняется, поэтому при 0
+            // горячей остается одна сессия.
+            std::size_t m_max_hot_sessions = 1024;
+            // Максимум байт живых холодных сессий (0 - без
+            // ограничения). При превышении удаляются самые старые
+            // холодные сессии. Файл FileColdStore может быть больше,
+            // см. FileColdStore::fileBytes().
+            std::size_t m_max_cold_bytes = 0;
+        };
+
+        // Метрики работы таблицы
+        struct Metrics
+        {
+            std::uint64_t m_hits = 0;         // Сессия была горячей
+            std::uint64_t m_rehydrations = 0; // Поднята из холодного
+            std::uint64_t m_created = 0;      // Новая сессия
+            std::uint64_t m_evictions = 0;    // Вытеснена в холодное
+            std::uint64_t m_dropped = 0;      // Удалена по бюджету
+                                              // или не загрузилась
+            std::uint64_t m_reclaimed = 0;    // Завершилась и удалена
+            std::uint64_t m_rehydration_ns = 0;
+            std::uint64_t m_max_rehydration_ns = 0;
+
+            /// @brief Доля обращений к уже горячим сессиям
+            double hitRate() const
+            {
+                auto total = m_hits + m_rehydrations + m_created;
+                return total ? double(m_hits) / total : 0.0;
+            }
+
+            /// @brief Средняя задержка восстановления сессии, мкс
+            double avgRehydrationUs() const
+            {
+                return m_rehydrations
+                           ? m_rehydration_ns / 1000.0 / m_rehydrations
+                           : 0.0;
+            }
+        };
+
+        /// @param factory Создает новый (не инициализированный) сценарий
+        /// @param budget Бюджеты памяти
+        /// @param cold Холодное хранилище, по умолчанию в памяти
+        SessionStore(Factory factory, Budget budget = {},
+                     std::unique_ptr<ColdStore> cold = nullptr)
+            : m_factory(std::move(factory))
+            , m_budget(budget)
+            , m_cold(cold ? std::move(cold)
+                          : std::make_unique<MemoryColdStore>())
+        {
+        }
+
+        /// @brief Передать данные в сессию. Холодная сессия прозрачно
+        /// восстанавливается, неизвестная - создается.
+        /// @param id Идентификатор сессии
+        /// @param params Данные для передачи в сценарий
+        /// @return Событие, возвращенное сценарием. Завершившаяся сессия
+        /// (Scenario::isFinished) сразу удаляется.
+        Event update(SessionId id, const outsideParams &params)
+        {
+            ScenarioT *scenario = acquire(id);
+            if (!scenario)
+                return Event(Events::Type::None);
+            Event event = scenario->update(params);
+            if (scenario->isFinished())
+            {
+                erase(id);
+                ++m_metrics.m_reclaimed;
+            }
+            return event;
+        }
+
+        /// @brief Получить горячую сессию (с восстановлением/созданием)
+        /// @param id Идентификатор сессии
+        /// @return Сценарий сессии или nullptr, если восстановить не
+        /// удалось
+        ScenarioT *acquire(SessionId id)
+        {
+            auto it = m_hot.find(id);
+            if (it != m_hot.end())
+            {
+                ++m_metrics.m_hits;
+                m_lru.splice(m_lru.begin(), m_lru, it->second.m_lru_pos);
+                return it->second.m_scenario.get();
+            }
+
+            // Задержка восстановления включает пересборку сценария
+            auto start = std::chrono::steady_clock::now();
+            auto scenario = m_factory();
+            scenario->init({});
+            auto cold = m_cold_pos.find(id);
+            if (cold != m_cold_pos.end())
+            {
+                bool taken = m_cold->take(id, m_buffer);
+                m_cold_order.erase(cold->second);
+                m_cold_pos.erase(cold);
+                std::size_t pos = 0;
+                if (!taken || !scenario->loadSession(m_buffer, pos))
+                {
+                    // Запись потеряна или испорчена: следующий update()
+                    // начнет сессию заново
+                    SM_LOG("Cannot load cold session: " << id << "\n");
+                    ++m_metrics.m_dropped;
+                    return nullptr;
+                }
+                auto ns = std::chrono::duration_cast<
+                              std::chrono::nanoseconds>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+                ++m_metrics.m_rehydrations;
+                m_metrics.m_rehydration_ns += ns;
+                m_metrics.m_max_rehydration_ns = std::max<std::uint64_t>(
+                    m_metrics.m_max_rehydration_ns, ns);
+            }
+            else
+                ++m_metrics.m_created;
+
+            if (m_recorder)
+                scenario->setRecorder(m_recorder, id);
+            m_lru.push_front(id);
+            auto *raw = scenario.get();
+            m_hot[id] = HotEntry{std::move(scenario), m_lru.begin()};
+            enforceBudget();
+            return raw;
+        }
+
+        /// @brief Удалить сессию из обоих уровней
+        void erase(SessionId id)
+        {
+            auto it = m_hot.find(id);
+            if (it != m_hot.end())
+            {
+                m_lru.erase(it->second.m_lru_pos);
+                m_hot.erase(it);
+                return;
+            }
+            auto cit = m_cold_pos.find(id);
+            if (cit != m_cold_pos.end())
+            {
+                m_cold->erase(id);
+                m_cold_order.erase(cit->second);
+                m_cold_pos.erase(cit);
+            }
+        }
+
+        /// @brief Вытеснить все горячие сессии в холодное хранилище
+        void evictAll()
+        {
+            while (!m_lru.empty())
+                evictOldest();
+        }
+
+        /// @brief Записывать входящий поток всех сессий
+        /// @param recorder Получатель (nullptr - отключить запись)
+        void setRecorder(UpdateRecorder *recorder)
+        {
+            m_recorder = recorder;
+            for (auto &[id, entry] : m_hot)
+                entry.m_scenario->setRecorder(recorder, id);
+        }
+
+        /// @brief Изменить бюджеты памяти
+        void setBudget(const Budget &budget)
+        {
+            m_budget = budget;
+            enforceBudget();
+        }
+
+        std::size_t hotCount() const
+        {
+            return m_hot.size();
+        }
+
+        std::size_t coldCount() const
+        {
+            return m_cold->size();
+        }
+
+        std::size_t coldBytes() const
+        {
+            return m_cold->bytes();
+        }
+
+        const Metrics &metrics() const
+        {
+            return m_metrics;
+        }
+
+      private:
+        struct HotEntry
+        {
+            std::unique_ptr<ScenarioT> m_scenario;
+            std::list<SessionId>::iterator m_lru_pos;
+        };
+
+        /// @brief Вытеснить самую давнюю горячую сессию
+        void evictOldest()
+        {
+            SessionId id = m_lru.back();
+            m_lru.pop_back();
+            auto it = m_hot.find(id);
+            m_buffer.clear();
+            it->second.m_scenario->saveSession(m_buffer);
+            m_hot.erase(it);
+
+            m_cold->put(id, m_buffer);
+            m_cold_order.push_back(id);
+            m_cold_pos[id] = std::prev(m_cold_order.end());
+            ++m_metrics.m_evictions;
+        }
+
+        /// @brief Привести размеры уровней к бюджетам
+        void enforceBudget()
+        {
+            // Самая свежая сессия не вытесняется: acquire() возвращает
+            // на нее указатель
+            while (m_hot.size() > m_budget.m_max_hot_sessions &&
+                   m_lru.size() > 1)
+                evictOldest();
+
+            while (m_budget.m_max_cold_bytes &&
+                   m_cold->bytes() > m_budget.m_max_cold_bytes &&
+                   !m_cold_order.empty())
+            {
+                SessionId id = m_cold_order.front();
+                m_cold_order.pop_front();
+                m_cold_pos.erase(id);
+                m_cold->erase(id);
+                ++m_metrics.m_dropped;
+            }
+        }
+
+        Factory m_factory;
+        Budget m_budget;
+        std::unique_ptr<ColdStore> m_cold;
+
+        // Горячие сессии и порядок обращений (в начале - самые свежие)
+        std::unordered_map<SessionId, HotEntry> m_hot;
+        std::list<SessionId> m_lru;
+
+        // Порядок попадания сессий в холодное хранилище
+        std::list<SessionId> m_cold_order;
+        std::unordered_map<SessionId, std::list<SessionId>::iterator>
+            m_cold_pos;
+
+        UpdateRecorder *m_recorder = nullptr;
+
+        // Буфер сериализации, чтобы не выделять память на каждый вызов
+        std::string m_buffer;
+        Metrics m_metrics;
+    };
+} // namespace SM
+
+#endif // !SESSIONSTORE_HPP
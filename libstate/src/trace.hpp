@@ -0,0 +1,356 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include "libstate.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пространство имен библиотеки состояний
+namespace SM
+{
+    // Запись и воспроизведение входящего потока Scenario::update.
+    //
+    // Формат файла трассы:
+    //   заголовок: "SMTR" + байт версии;
+    //   записи подряд, все числа в varint:
+    //     id сессии, приращение времени от предыдущей записи (нс),
+    //     число параметров, затем для каждого: длина ключа, ключ,
+    //     длина значения, значение.
+    namespace Trace
+    {
+        constexpr char kMagic[4] = {'S', 'M', 'T', 'R'};
+        constexpr char kVersion = 1;
+
+        // Одно сообщение из трассы
+        struct Record
+        {
+            SessionId m_session = 0;
+            std::uint64_t m_time_ns = 0; // От начала записи трассы
+            outsideParams m_params;
+        };
+
+        // Запись трассы в файл. Может использоваться из нескольких
+        // потоков и несколькими сценариями одновременно. Если файл не
+        // открылся, запись отключается (см. isOpen()).
+        class Recorder : public UpdateRecorder
+        {
+          public:
+            Recorder(const std::string &path)
+                : m_file(path, std::ios::binary | std::ios::trunc)
+                , m_start(std::chrono::steady_clock::now())
+            {
+                if (!m_file)
+                {
+                    SM_LOG("Cannot open trace file: " << path << "\n");
+                    return;
+                }
+                m_file.write(kMagic, sizeof(kMagic));
+                m_file.put(kVersion);
+            }
+
+            ~Recorder() override
+            {
+                flush();
+            }
+
+            void record(SessionId id, const outsideParams &params) override
+            {
+                if (!isOpen())
+                    return;
+                auto now = std::chrono::duration_cast<
+                               std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now() - m_start)
+                               .count();
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                // Время монотонно: при гонке потоков дельта не
+                // становится отрицательной
+                std::uint64_t time = std::max<std::uint64_t>(now, m_last);
+                Encoding::writeVarint(m_buffer, id);
+                Encoding::writeVarint(m_buffer, time - m_last);
+                Encoding::writeVarint(m_buffer, params.size());
+                for (const auto &[key, value] : params)
+                {
+                    Encoding::writeVarint(m_buffer, key.size());
+                    m_buffer += key;
+                    Encoding::writeVarint(m_buffer, value.size());
+                    m_buffer += value;
+                }
+                m_last = time;
+                ++m_count;
+
+                if (m_buffer.size() >= kFlushBytes)
+                    flushLocked();
+            }
+
+            /// @brief Сбросить накопленные записи в файл
+            void flush()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                flushLocked();
+            }
+
+            /// @brief Открыт ли файл трассы
+            bool isOpen() const
+            {
+                return m_file.is_open();
+            }
+
+            /// @brief Количество записанных сообщений
+            std::size_t count() const
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                return m_count;
+            }
+
+          private:
+            static constexpr std::size_t kFlushBytes = 64 * 1024;
+
+            void flushLocked()
+            {
+                if (!isOpen())
+                    return;
+                m_file.write(m_buffer.data(), m_buffer.size());
+                m_file.flush();
+                m_buffer.clear();
+            }
+
+            std::ofstream m_file;
+            std::chrono::steady_clock::time_point m_start;
+            mutable std::mutex m_mutex;
+            std::string m_buffer;
+            std::uint64_t m_last = 0;
+            std::size_t m_count = 0;
+        };
+
+        /// @brief Прочитать трассу из файла целиком
+        /// @param path Путь к файлу
+        /// @param records Сюда добавляются прочитанные сообщения
+        /// @return Удалось ли прочитать файл без ошибок формата
+        inline bool load(const std::string &path,
+                         std::vector<Record> &records)
+        {
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+            {
+                SM_LOG("Cannot open trace file: " << path << "\n");
+                return false;
+            }
+            std::string data((std::istreambuf_iterator<char>(file)),
+                             std::istreambuf_iterator<char>());
+            if (data.size() < sizeof(kMagic) + 1 ||
+                data.compare(0, sizeof(kMagic), kMagic, sizeof(kMagic)) ||
+                data[sizeof(kMagic)] != kVersion)
+            {
+                SM_LOG("Bad trace header: " << path << "\n");
+                return false;
+            }
+
+            auto readString = [&data](std::size_t &pos, std::string &out) {
+                std::uint64_t len = 0;
+                if (!Encoding::readVarint(data, pos, len) ||
+                    len > data.size() - pos)
+                    return false;
+                out.assign(data, pos, len);
+                pos += len;
+                return true;
+            };
+
+            std::size_t pos = sizeof(kMagic) + 1;
+            std::uint64_t time = 0;
+            while (pos < data.size())
+            {
+                Record rec;
+                std::uint64_t delta = 0, count = 0;
+                if (!Encoding::readVarint(data, pos, rec.m_session) ||
+                    !Encoding::readVarint(data, pos, delta) ||
+                    !Encoding::readVarint(data, pos, count))
+                {
+                    SM_LOG("Truncated trace record\n");
+                    return false;
+                }
+                time += delta;
+                rec.m_time_ns = time;
+                for (std::uint64_t i = 0; i < count; ++i)
+                {
+                    std::string key, value;
+                    if (!readString(pos, key) || !readString(pos, value))
+                    {
+                        SM_LOG("Truncated trace record\n");
+                        return false;
+                    }
+                    rec.m_params.emplace(std::move(key), std::move(value));
+                }
+                records.push_back(std::move(rec));
+            }
+            return true;
+        }
+
+        // Результат воспроизведения трассы
+        struct Report
+        {
+            std::size_t m_messages = 0;
+            std::size_t m_sessions = 0;
+            double m_seconds = 0;
+            // Задержка одного update(), нс
+            std::uint64_t m_p50_ns = 0;
+            std::uint64_t m_p99_ns = 0;
+            std::uint64_t m_p999_ns = 0;
+            std::uint64_t m_max_ns = 0;
+            // Итоговое распределение сессий по состояниям
+            std::map<std::string, std::size_t> m_final_states;
+
+            /// @brief Сообщений в секунду
+            double throughput() const
+            {
+                return m_seconds > 0 ? m_messages / m_seconds : 0.0;
+            }
+
+            /// @brief Вывести отчет
+            void print(std::ostream &out) const
+            {
+                out << "messages:   " << m_messages << "\n"
+                    << "sessions:   " << m_sessions << "\n"
+                    << "seconds:    " << m_seconds << "\n"
+                    << "throughput: " << throughput() << " msg/s\n"
+                    << "latency ns: p50=" << m_p50_ns
+                    << " p99=" << m_p99_ns << " p99.9=" << m_p999_ns
+                    << " max=" << m_max_ns << "\n"
+                    << "final states:\n";
+                for (const auto &[name, count] : m_final_states)
+                    out << "  " << name << ": " << count << "\n";
+            }
+        };
+
+        // Воспроизведение трассы через любой сценарий. Сессии
+        // распределяются по потокам по id, поэтому порядок сообщений
+        // внутри одной сессии сохраняется.
+        template <typename ScenarioT>
+        class Replayer
+        {
+          public:
+            using Factory = std::function<std::unique_ptr<ScenarioT>()>;
+
+            struct Options
+            {
+                std::size_t m_threads = 1;
+                // true - соблюдать исходные интервалы между сообщениями,
+                // false - максимальная скорость
+                bool m_paced = false;
+            };
+
+            Replayer(Factory factory)
+                : m_factory(std::move(factory))
+            {
+            }
+
+            /// @brief Воспроизвести трассу
+            /// @param records Сообщения в порядке записи
+            /// @param options Параметры воспроизведения
+            Report run(const std::vector<Record> &records,
+                       const Options &options)
+            {
+                std::size_t threads = std::max<std::size_t>(
+                    options.m_threads, 1);
+
+                // Раскладываем сообщения по потокам заранее, чтобы не
+                // мерить распределение вместе с update()
+                std::vector<std::vector<const Record *>> parts(threads);
+                for (const auto &rec : records)
+                    parts[rec.m_session % threads].push_back(&rec);
+
+                std::vector<Worker> workers(threads);
+                std::vector<std::thread> pool;
+                auto start = std::chrono::steady_clock::now();
+                for (std::size_t i = 0; i < threads; ++i)
+                    pool.emplace_back([this, &parts, &workers, &options,
+                                       start, i] {
+                        replay(parts[i], workers[i], options.m_paced,
+                               start);
+                    });
+                for (auto &thread : pool)
+                    thread.join();
+                auto finish = std::chrono::steady_clock::now();
+
+                Report report;
+                std::vector<std::uint64_t> latencies;
+                latencies.reserve(records.size());
+                for (auto &worker : workers)
+                {
+                    latencies.insert(latencies.end(),
+                                     worker.m_latencies.begin(),
+                                     worker.m_latencies.end());
+                    report.m_sessions += worker.m_sessions.size();
+                    for (const auto &[id, scenario] : worker.m_sessions)
+                    {
+                        auto *state = scenario->getCurrentState();
+                        ++report.m_final_states[state ? state->getName()
+                                                      : "<none>"];
+                    }
+                }
+                report.m_messages = latencies.size();
+                report.m_seconds =
+                    std::chrono::duration<double>(finish - start).count();
+                std::sort(latencies.begin(), latencies.end());
+                if (!latencies.empty())
+                {
+                    auto at = [&latencies](double q) {
+                        return latencies[std::min(
+                            latencies.size() - 1,
+                            std::size_t(q * latencies.size()))];
+                    };
+                    report.m_p50_ns = at(0.5);
+                    report.m_p99_ns = at(0.99);
+                    report.m_p999_ns = at(0.999);
+                    report.m_max_ns = latencies.back();
+                }
+                return report;
+            }
+
+          private:
+            struct Worker
+            {
+                std::unordered_map<SessionId, std::unique_ptr<ScenarioT>>
+                    m_sessions;
+                std::vector<std::uint64_t> m_latencies;
+            };
+
+            void replay(const std::vector<const Record *> &part,
+                        Worker &worker, bool paced,
+                        std::chrono::steady_clock::time_point start)
+            {
+                worker.m_latencies.reserve(part.size());
+                for (const auto *rec : part)
+                {
+                    if (paced)
+                        std::this_thread::sleep_until(
+                            start + std::chrono::nanoseconds(rec->m_time_ns));
+
+                    auto &scenario = worker.m_sessions[rec->m_session];
+                    if (!scenario)
+                    {
+                        scenario = m_factory();
+                        scenario->init({});
+                    }
+
+                    auto begin = std::chrono::steady_clock::now();
+                    scenario->update(rec->m_params);
+                    auto end = std::chrono::steady_clock::now();
+                    worker.m_latencies.push_back(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            end - begin)
+                            .count());
+                }
+            }
+
+            Factory m_factory;
+        };
+    } // namespace Trace
+} // namespace SM
+
+#endif // !TRACE_HPP